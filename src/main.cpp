@@ -1,1155 +1,3611 @@
-#include <cassert>
-#include <cstdlib>
-#include <ctime>
-#include <algorithm>
-#include <array>
-#include <vector>
-#include <future>
-
-#include <FL/Fl.H>
-#include <FL/fl_draw.H>
-#include <FL/Fl_Double_Window.H>
-#include <FL/Fl_Menu_Bar.H>
-#include <FL/Fl_Box.H>
-#include <FL/Fl_Group.H>
-#include <FL/Fl_Scroll.H>
-#include <FL/Fl_Slider.H>
-#include <FL/platform.H>
-
-enum class Pitch {
-	REST,
-	C_NAT,
-	C_SHARP,
-	D_NAT,
-	D_SHARP,
-	E_NAT,
-	F_NAT,
-	F_SHARP,
-	G_NAT,
-	G_SHARP,
-	A_NAT,
-	A_SHARP,
-	B_NAT,
-};
-
-struct Note_View {
-	int32_t length = 0;
-	Pitch pitch = Pitch::REST;
-	int32_t octave = 0;
-	int32_t speed = 0;
-};
-
-const Fl_Color NOTE_RED   = fl_rgb_color(217,   0,   0);
-const Fl_Color NOTE_BLUE  = fl_rgb_color(  0, 117, 253);
-const Fl_Color NOTE_GREEN = fl_rgb_color(  0, 165,   0);
-const Fl_Color NOTE_BROWN = fl_rgb_color(124,  60,  25);
-
-const Fl_Color NOTE_RED_LIGHT   = fl_lighter(NOTE_RED);
-const Fl_Color NOTE_BLUE_LIGHT  = fl_lighter(NOTE_BLUE);
-const Fl_Color NOTE_GREEN_LIGHT = fl_lighter(NOTE_GREEN);
-const Fl_Color NOTE_BROWN_LIGHT = fl_lighter(NOTE_BROWN);
-
-constexpr size_t NUM_WHITE_NOTES = 7;
-constexpr size_t NUM_BLACK_NOTES = 5;
-
-constexpr size_t NUM_NOTES_PER_OCTAVE = NUM_WHITE_NOTES + NUM_BLACK_NOTES;
-constexpr size_t NUM_OCTAVES = 8;
-
-constexpr int WHITE_KEY_WIDTH  = 150;
-constexpr int WHITE_KEY_HEIGHT = 24;
-
-constexpr int BLACK_KEY_WIDTH  = 100;
-constexpr int BLACK_KEY_HEIGHT = 20;
-
-constexpr int TICK_WIDTH = 3;
-constexpr int TICKS_PER_STEP = 12;
-
-struct Note_Key {
-	int y, delta;
-	Pitch pitch;
-	bool white;
-};
-
-constexpr Note_Key NOTE_KEYS[NUM_NOTES_PER_OCTAVE] {
-	{  0,  0, Pitch::B_NAT,   true },
-	{  1,  0, Pitch::A_NAT,   true },
-	{  2, +1, Pitch::G_NAT,   true },
-	{  3, +1, Pitch::F_NAT,   true },
-	{  4, -1, Pitch::E_NAT,   true },
-	{  5, -1, Pitch::D_NAT,   true },
-	{  6,  0, Pitch::C_NAT,   true },
-	{  1,  0, Pitch::A_SHARP, false },
-	{  3,  0, Pitch::G_SHARP, false },
-	{  5,  0, Pitch::F_SHARP, false },
-	{  8,  0, Pitch::D_SHARP, false },
-	{ 10,  0, Pitch::C_SHARP, false },
-};
-constexpr size_t PITCH_TO_KEY_INDEX[NUM_NOTES_PER_OCTAVE] {
-	6,  // C
-	11, // C#
-	5,  // D
-	10, // D#
-	4,  // E
-	3,  // F
-	9,  // F#
-	2,  // G
-	8,  // G#
-	1,  // A
-	7,  // A#
-	0,  // B
-};
-
-constexpr char const *C_KEY_LABELS[] {
-	"C1",
-	"C2",
-	"C3",
-	"C4",
-	"C5",
-	"C6",
-	"C7",
-	"C8",
-};
-
-class Note_Box : public Fl_Box {
-private:
-	const Note_View &_note_view;
-	int32_t _tick = 0;
-public:
-	Note_Box(const Note_View &n, int32_t t, int X, int Y, int W, int H, const char *l = nullptr);
-
-	inline const Note_View &note_view() const { return _note_view; }
-	inline int32_t tick() const { return _tick; }
-};
-
-class Key_Box : public Fl_Box {
-public:
-	using Fl_Box::Fl_Box;
-};
-
-class White_Key_Box : public Key_Box {
-public:
-	using Key_Box::Key_Box;
-protected:
-	void draw() override;
-};
-
-class Piano_Timeline;
-
-class Piano_Keys : public Fl_Group {
-private:
-	std::array<Key_Box *, NUM_NOTES_PER_OCTAVE * NUM_OCTAVES> _keys;
-
-	Pitch   _channel_1_pitch = Pitch::REST;
-	int32_t _channel_1_octave = 0;
-	Pitch   _channel_2_pitch = Pitch::REST;
-	int32_t _channel_2_octave = 0;
-	Pitch   _channel_3_pitch = Pitch::REST;
-	int32_t _channel_3_octave = 0;
-	Pitch   _channel_4_pitch = Pitch::REST;
-	int32_t _channel_4_octave = 0;
-public:
-	Piano_Keys(int X, int Y, int W, int H, const char *l = nullptr);
-
-	Piano_Keys(const Piano_Keys&) = delete;
-	Piano_Keys& operator=(const Piano_Keys&) = delete;
-
-	Piano_Timeline *parent() const { return (Piano_Timeline *)Fl_Group::parent(); }
-
-	void calc_sizes();
-
-	void set_key_color(Pitch pitch, int32_t octave, Fl_Color color);
-	void update_key_colors();
-	void reset_key_colors();
-
-	inline void set_channel_1_pitch(Pitch p, int32_t o) { _channel_1_pitch = p; _channel_1_octave = o; }
-	inline void set_channel_2_pitch(Pitch p, int32_t o) { _channel_2_pitch = p; _channel_2_octave = o; }
-	inline void set_channel_3_pitch(Pitch p, int32_t o) { _channel_3_pitch = p; _channel_3_octave = o; }
-	inline void set_channel_4_pitch(Pitch p, int32_t o) { _channel_4_pitch = p; _channel_4_octave = o; }
-
-	void set_channel_pitch(int channel_number, Pitch p, int32_t o);
-	void reset_channel_pitches();
-};
-
-class Piano_Roll;
-
-class Piano_Timeline : public Fl_Group {
-	friend class Piano_Roll;
-private:
-	Piano_Keys _keys;
-	std::vector<Note_Box *> _channel_1_notes;
-	std::vector<Note_Box *> _channel_2_notes;
-	std::vector<Note_Box *> _channel_3_notes;
-	std::vector<Note_Box *> _channel_4_notes;
-
-	int32_t _cursor_tick = -1;
-public:
-	Piano_Timeline(int X, int Y, int W, int H, const char *l = nullptr);
-	~Piano_Timeline() noexcept;
-
-	Piano_Timeline(const Piano_Timeline&) = delete;
-	Piano_Timeline& operator=(const Piano_Timeline&) = delete;
-
-	Piano_Roll *parent() const { return (Piano_Roll *)Fl_Group::parent(); }
-
-	void calc_sizes();
-
-	void highlight_channel_1_tick(int32_t tick) { highlight_tick(_channel_1_notes, 1, tick, NOTE_RED_LIGHT); }
-	void highlight_channel_2_tick(int32_t tick) { highlight_tick(_channel_2_notes, 2, tick, NOTE_BLUE_LIGHT); }
-	void highlight_channel_3_tick(int32_t tick) { highlight_tick(_channel_3_notes, 3, tick, NOTE_GREEN_LIGHT); }
-	void highlight_channel_4_tick(int32_t tick) { highlight_tick(_channel_4_notes, 4, tick, NOTE_BROWN_LIGHT); }
-
-	void set_channel_1(const std::vector<Note_View> &notes) { set_channel(_channel_1_notes, 1, notes, NOTE_RED); }
-	void set_channel_2(const std::vector<Note_View> &notes) { set_channel(_channel_2_notes, 2, notes, NOTE_BLUE); }
-	void set_channel_3(const std::vector<Note_View> &notes) { set_channel(_channel_3_notes, 3, notes, NOTE_GREEN); }
-	void set_channel_4(const std::vector<Note_View> &notes) { set_channel(_channel_4_notes, 4, notes, NOTE_BROWN); }
-
-	void reset_note_colors();
-private:
-	void highlight_tick(std::vector<Note_Box *> &notes, int channel_number, int32_t tick, Fl_Color color);
-	void set_channel(std::vector<Note_Box *> &channel, int channel_number, const std::vector<Note_View> &notes, Fl_Color color);
-protected:
-	void draw() override;
-};
-
-class Main_Window;
-
-class Piano_Roll : public Fl_Scroll {
-private:
-	int32_t _tick = -1;
-	bool _following = false;
-	bool _continuous = true;
-	bool _paused = false;
-	int _ticks_per_step = TICKS_PER_STEP;
-
-	Piano_Timeline _piano_timeline;
-
-	std::vector<Note_View> _channel_1_notes;
-	std::vector<Note_View> _channel_2_notes;
-	std::vector<Note_View> _channel_3_notes;
-	std::vector<Note_View> _channel_4_notes;
-
-	int32_t _song_length = -1;
-public:
-	Piano_Roll(int X, int Y, int W, int H, const char *l = nullptr);
-	~Piano_Roll() noexcept;
-
-	Piano_Roll(const Piano_Roll&) = delete;
-	Piano_Roll& operator=(const Piano_Roll&) = delete;
-
-	Main_Window *parent() const { return (Main_Window *)Fl_Scroll::parent(); }
-
-	inline int32_t tick() const { return _tick; }
-	inline bool following() const { return _following; }
-	inline bool paused() const { return _paused; }
-	inline int ticks_per_step() const { return _ticks_per_step; }
-
-	int white_key_height() const;
-	int black_key_height() const;
-	int octave_height() const;
-	int note_row_height() const;
-	int black_key_offset() const;
-	int tick_width() const;
-
-	void set_continuous_scroll(bool c) { _continuous = c; }
-
-	void set_size(int W, int H);
-	void set_timeline_width();
-
-	void set_timeline();
-
-	void build_note_view(int channel_number, std::vector<Note_View> &notes, Fl_Color color);
-
-	int32_t get_last_note_x() const;
-
-	void start_following();
-	void unpause_following();
-	void stop_following();
-	void pause_following();
-	void highlight_tick(int32_t t);
-	void focus_cursor(bool center = false);
-	void sticky_keys();
-
-	void scroll_to_y_max();
-	void scroll_to(int X, int Y);
-
-	int scroll_x_max() const;
-	int scroll_y_max() const;
-private:
-	static void scrollbar_cb(Fl_Scrollbar *sb, void *);
-	static void hscrollbar_cb(Fl_Scrollbar *sb, void *);
-};
-
-static inline bool is_white_key(size_t i) {
-	return !(i == 1 || i == 3 || i == 5 || i == 8 || i == 10);
-}
-
-Note_Box::Note_Box(const Note_View &n, int32_t t, int X, int Y, int W, int H, const char *l) : Fl_Box(X, Y, W, H, l), _note_view(n), _tick(t) {}
-
-void White_Key_Box::draw() {
-	draw_box();
-	draw_label(x() + BLACK_KEY_WIDTH, y(), w() - BLACK_KEY_WIDTH, h());
-}
-
-Piano_Keys::Piano_Keys(int X, int Y, int W, int H, const char *l) : Fl_Group(X, Y, W, H, l) {
-	resizable(nullptr);
-	for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
-		for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
-			size_t i = _y * NUM_NOTES_PER_OCTAVE + _x;
-			if (NOTE_KEYS[_x].white) {
-				_keys[i] = new White_Key_Box(X, Y, 0, 0);
-				_keys[i]->box(FL_BORDER_BOX);
-				_keys[i]->color(FL_WHITE);
-				if (NOTE_KEYS[_x].pitch == Pitch::C_NAT) {
-					_keys[i]->label(C_KEY_LABELS[NUM_OCTAVES - _y - 1]);
-				}
-			}
-			else {
-				_keys[i] = new Key_Box(X, Y, 0, 0);
-				_keys[i]->box(FL_BORDER_BOX);
-				_keys[i]->color(FL_FOREGROUND_COLOR);
-			}
-		}
-	}
-	end();
-	calc_sizes();
-}
-
-void Piano_Keys::calc_sizes() {
-	const Piano_Roll *piano_roll = parent()->parent();
-	const int white_key_height = piano_roll->white_key_height();
-	const int black_key_height = piano_roll->black_key_height();
-	const int octave_height = piano_roll->octave_height();
-	const int note_row_height = piano_roll->note_row_height();
-	const int black_key_offset = piano_roll->black_key_offset();
-
-	int white_delta = 0, black_delta = 0;
-
-	int y_top = _keys[0]->y();
-
-	for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
-		int y_pos = octave_height * (int)_y;
-		for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
-			size_t i = _y * NUM_NOTES_PER_OCTAVE + _x;
-			int delta = NOTE_KEYS[_x].delta;
-			if (NOTE_KEYS[_x].white) {
-				_keys[i]->resize(
-					_keys[i]->x(),
-					y_top + y_pos + NOTE_KEYS[_x].y * white_key_height + white_delta,
-					WHITE_KEY_WIDTH,
-					white_key_height + delta
-				);
-				white_delta += delta;
-			}
-			else {
-				_keys[i]->resize(
-					_keys[i]->x(),
-					y_top + y_pos + NOTE_KEYS[_x].y * note_row_height + black_key_offset + black_delta,
-					BLACK_KEY_WIDTH,
-					black_key_height + delta
-				);
-				black_delta += delta;
-			}
-		}
-	}
-
-	size(w(), NUM_OCTAVES * octave_height);
-}
-
-void Piano_Keys::set_key_color(Pitch pitch, int32_t octave, Fl_Color color) {
-	size_t _y = NUM_OCTAVES - octave;
-	size_t _x = PITCH_TO_KEY_INDEX[(size_t)pitch - 1];
-	size_t i = _y * NUM_NOTES_PER_OCTAVE + _x;
-	if (_keys[i]->color() != color) {
-		_keys[i]->color(color);
-		_keys[i]->redraw();
-	}
-}
-
-void Piano_Keys::update_key_colors() {
-	reset_key_colors();
-	if (_channel_1_pitch != Pitch::REST) {
-		set_key_color(_channel_1_pitch, _channel_1_octave, NOTE_RED_LIGHT);
-	}
-	if (_channel_2_pitch != Pitch::REST) {
-		set_key_color(_channel_2_pitch, _channel_2_octave, NOTE_BLUE_LIGHT);
-	}
-	if (_channel_3_pitch != Pitch::REST) {
-		set_key_color(_channel_3_pitch, _channel_3_octave, NOTE_GREEN_LIGHT);
-	}
-	if (_channel_4_pitch != Pitch::REST) {
-		set_key_color(_channel_4_pitch, _channel_4_octave, NOTE_BROWN_LIGHT);
-	}
-}
-
-void Piano_Keys::reset_key_colors() {
-	for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
-		for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
-			size_t i = _y * NUM_NOTES_PER_OCTAVE + _x;
-			Fl_Color color = NOTE_KEYS[_x].white ? FL_WHITE : FL_FOREGROUND_COLOR;
-			if (_keys[i]->color() != color) {
-				_keys[i]->color(color);
-				_keys[i]->redraw();
-			}
-		}
-	}
-}
-
-void Piano_Keys::set_channel_pitch(int channel_number, Pitch p, int32_t o) {
-	assert(channel_number >= 1 && channel_number <= 4);
-	if (channel_number == 1) {
-		set_channel_1_pitch(p, o);
-	}
-	else if (channel_number == 2) {
-		set_channel_2_pitch(p, o);
-	}
-	else if (channel_number == 3) {
-		set_channel_3_pitch(p, o);
-	}
-	else {
-		set_channel_4_pitch(p, o);
-	}
-}
-
-void Piano_Keys::reset_channel_pitches() {
-	set_channel_1_pitch(Pitch::REST, 0);
-	set_channel_2_pitch(Pitch::REST, 0);
-	set_channel_3_pitch(Pitch::REST, 0);
-	set_channel_4_pitch(Pitch::REST, 0);
-	update_key_colors();
-}
-
-Piano_Timeline::Piano_Timeline(int X, int Y, int W, int H, const char *l) :
-	Fl_Group(X, Y, W, H, l),
-	_keys(X, Y, WHITE_KEY_WIDTH, H)
-{
-	resizable(nullptr);
-	end();
-}
-
-Piano_Timeline::~Piano_Timeline() noexcept {
-	remove(_keys);
-	Fl_Group::clear();
-}
-
-void Piano_Timeline::calc_sizes() {
-	const int octave_height = parent()->octave_height();
-	const int note_row_height = parent()->note_row_height();
-	const int tick_width = parent()->tick_width();
-
-	const auto tick_to_x_pos = [&](int32_t tick) {
-		return x() + WHITE_KEY_WIDTH + tick * tick_width;
-	};
-	const auto pitch_to_y_pos = [&](Pitch pitch, int32_t octave) {
-		return y() + ((int)NUM_OCTAVES - octave) * octave_height + ((int)NUM_NOTES_PER_OCTAVE - (int)(pitch)) * note_row_height;
-	};
-
-	const auto resize_notes = [&](std::vector<Note_Box *> &notes) {
-		for (Note_Box *note : notes) {
-			note->resize(
-				tick_to_x_pos(note->tick()),
-				pitch_to_y_pos(note->note_view().pitch, note->note_view().octave),
-				note->note_view().length * note->note_view().speed * tick_width,
-				note_row_height
-			);
-		}
-	};
-
-	resize_notes(_channel_1_notes);
-	resize_notes(_channel_2_notes);
-	resize_notes(_channel_3_notes);
-	resize_notes(_channel_4_notes);
-}
-
-void Piano_Timeline::reset_note_colors() {
-	for (Note_Box *note : _channel_1_notes) {
-		note->color(NOTE_RED);
-	}
-	for (Note_Box *note : _channel_2_notes) {
-		note->color(NOTE_BLUE);
-	}
-	for (Note_Box *note : _channel_3_notes) {
-		note->color(NOTE_GREEN);
-	}
-	for (Note_Box *note : _channel_4_notes) {
-		note->color(NOTE_BROWN);
-	}
-}
-
-void Piano_Timeline::highlight_tick(std::vector<Note_Box *> &notes, int channel_number, int32_t tick, Fl_Color color) {
-	_keys.set_channel_pitch(channel_number, Pitch::REST, 0);
-	for (Note_Box *note : notes) {
-		const Note_View &view = note->note_view();
-		int32_t t_left = note->tick();
-		int32_t t_right = t_left + view.length * view.speed;
-		if (t_left > tick) {
-			return;
-		}
-		if (t_right > tick) {
-			_keys.set_channel_pitch(channel_number, view.pitch, view.octave);
-		}
-		if (note->color() != color) {
-			note->color(color);
-			note->redraw();
-		}
-	}
-}
-
-void Piano_Timeline::set_channel(std::vector<Note_Box *> &channel, int channel_number, const std::vector<Note_View> &notes, Fl_Color color) {
-	const int octave_height = parent()->octave_height();
-	const int note_row_height = parent()->note_row_height();
-	const int tick_width = parent()->tick_width();
-
-	const auto tick_to_x_pos = [&](int32_t tick) {
-		return x() + WHITE_KEY_WIDTH + tick * tick_width;
-	};
-	const auto pitch_to_y_pos = [&](Pitch pitch, int32_t octave) {
-		return y() + ((int)NUM_OCTAVES - octave) * octave_height + ((int)NUM_NOTES_PER_OCTAVE - (int)(pitch)) * note_row_height;
-	};
-
-	begin();
-	int32_t tick = 0;
-	for (const Note_View &note : notes) {
-		if (note.pitch != Pitch::REST) {
-			Note_Box *box = new Note_Box(
-				note,
-				tick,
-				tick_to_x_pos(tick),
-				pitch_to_y_pos(note.pitch, note.octave),
-				note.length * note.speed * tick_width,
-				note_row_height
-			);
-			box->box(FL_BORDER_BOX);
-			box->color(color);
-			channel.push_back(box);
-		}
-		tick += note.length * note.speed;
-	}
-	end();
-
-	// fix the keys as the last child
-	Fl_Widget **a = (Fl_Widget **)array();
-	if (a[children() - 1] != &_keys) {
-		int i, j;
-		for (i = j = 0; j < children(); j++) {
-			if (a[j] != &_keys) {
-				a[i++] = a[j];
-			}
-		}
-		a[i] = &_keys;
-	}
-}
-
-void Piano_Timeline::draw() {
-	Fl_Color light_row = FL_LIGHT1;
-	Fl_Color dark_row =FL_DARK2;
-	Fl_Color row_divider = dark_row;
-	Fl_Color col_divider = FL_DARK3;
-	Fl_Color cursor_color = FL_MAGENTA;
-
-	if (damage() & ~FL_DAMAGE_CHILD) {
-		Piano_Roll *p = parent();
-		const int note_row_height = p->note_row_height();
-		const int tick_width = p->tick_width();
-		const int ticks_per_step = p->ticks_per_step();
-
-		int y_pos = y();
-		for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
-			for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
-				if (is_white_key(_x)) {
-					fl_rectf(x(), y_pos, w(), note_row_height, light_row);
-				}
-				else {
-					fl_rectf(x(), y_pos, w(), note_row_height, dark_row);
-				}
-				if (_x == 0 || _x == 7) {
-					fl_color(row_divider);
-					fl_xyline(x(), y_pos - 1, x() + w());
-					fl_xyline(x(), y_pos, x() + w());
-				}
-				y_pos += note_row_height;
-			}
-		}
-
-		int x_pos = x() + WHITE_KEY_WIDTH;
-		int time_step_width = tick_width * ticks_per_step;
-		const size_t num_dividers = (w() - WHITE_KEY_WIDTH) / time_step_width + 1;
-		for (size_t i = 0; i < num_dividers; ++i) {
-			fl_color(col_divider);
-			fl_yxline(x_pos - 1, y(), y() + h());
-			x_pos += time_step_width;
-		}
-
-		_cursor_tick = p->tick();
-		if (_cursor_tick != -1 && (parent()->following() || parent()->paused())) {
-			_cursor_tick = _cursor_tick / ticks_per_step * ticks_per_step;
-		}
-		x_pos = x() + _cursor_tick * tick_width + WHITE_KEY_WIDTH;
-		fl_color(cursor_color);
-		fl_yxline(x_pos - 1, y(), y() + h());
-		fl_yxline(x_pos, y(), y() + h());
-	}
-	draw_children();
-}
-
-Piano_Roll::Piano_Roll(int X, int Y, int W, int H, const char *l) :
-	Fl_Scroll(X, Y, W, H, l),
-	_piano_timeline(X, Y, W - scrollbar.w(), NUM_OCTAVES * octave_height())
-{
-	type(BOTH_ALWAYS);
-	end();
-
-	scrollbar.callback((Fl_Callback *)scrollbar_cb);
-	hscrollbar.callback((Fl_Callback *)hscrollbar_cb);
-
-	set_timeline();
-}
-
-Piano_Roll::~Piano_Roll() noexcept {
-	remove(_piano_timeline);
-}
-
-int Piano_Roll::white_key_height() const {
-	return WHITE_KEY_HEIGHT;
-}
-
-int Piano_Roll::black_key_height() const {
-	return BLACK_KEY_HEIGHT;
-}
-
-int Piano_Roll::octave_height() const {
-	return white_key_height() * NUM_WHITE_NOTES;
-}
-
-int Piano_Roll::note_row_height() const {
-	return octave_height() / NUM_NOTES_PER_OCTAVE;
-}
-
-int Piano_Roll::black_key_offset() const {
-	return note_row_height() / 2 - black_key_height() / 2;
-}
-
-int Piano_Roll::tick_width() const {
-	return TICK_WIDTH;
-}
-
-void Piano_Roll::set_size(int W, int H) {
-	if (W != w() || H != h()) {
-		size(W, H);
-		set_timeline_width();
-		if (xposition() > scroll_x_max()) {
-			scroll_to(scroll_x_max(), yposition());
-			sticky_keys();
-		}
-		if (yposition() > scroll_y_max()) {
-			scroll_to(xposition(), scroll_y_max());
-		}
-	}
-}
-
-void Piano_Roll::set_timeline_width() {
-	_piano_timeline.w(std::max(WHITE_KEY_WIDTH + _song_length * tick_width(), w() - scrollbar.w()));
-	int32_t last_note_x = get_last_note_x();
-	int width = last_note_x + w() - scrollbar.w() - WHITE_KEY_WIDTH;
-	if (width > _piano_timeline.w()) {
-		_piano_timeline.w(width);
-	}
-}
-
-void Piano_Roll::set_timeline() {
-	_song_length = 3072;
-
-	_piano_timeline.begin();
-	build_note_view(1, _channel_1_notes, NOTE_RED);
-	build_note_view(2, _channel_2_notes, NOTE_BLUE);
-	build_note_view(3, _channel_3_notes, NOTE_GREEN);
-	build_note_view(4, _channel_4_notes, NOTE_BROWN);
-	_piano_timeline.end();
-
-	_piano_timeline.set_channel_1(_channel_1_notes);
-	_piano_timeline.set_channel_2(_channel_2_notes);
-	_piano_timeline.set_channel_3(_channel_3_notes);
-	_piano_timeline.set_channel_4(_channel_4_notes);
-
-	set_timeline_width();
-}
-
-void Piano_Roll::build_note_view(
-	int channel_number,
-	std::vector<Note_View> &notes,
-	Fl_Color color
-) {
-	int32_t tick = 0;
-
-	Note_View note;
-
-	while (tick < 3072 - 16) {
-		note.octave = channel_number;
-		note.speed = rand() % 4 + 1;
-		note.length = rand() % 4 + 1;
-		note.pitch = (Pitch)(rand() % 12 + 1);
-		tick += note.length * note.speed;
-		notes.push_back(note);
-	}
-}
-
-int32_t Piano_Roll::get_last_note_x() const {
-	const auto get_channel_last_note_x = [this](const std::vector<Note_Box *> &notes) {
-		if (notes.size() > 0) {
-			return notes.back()->x() - _piano_timeline.x();
-		}
-		return 0;
-	};
-	int32_t last_note_x = std::max({
-		get_channel_last_note_x(_piano_timeline._channel_1_notes),
-		get_channel_last_note_x(_piano_timeline._channel_2_notes),
-		get_channel_last_note_x(_piano_timeline._channel_3_notes),
-		get_channel_last_note_x(_piano_timeline._channel_4_notes),
-	});
-	return last_note_x;
-}
-
-void Piano_Roll::start_following() {
-	_following = true;
-	_paused = false;
-	_piano_timeline.reset_note_colors();
-	_piano_timeline._keys.reset_channel_pitches();
-	if (_tick == -1) {
-		scroll_to(0, yposition());
-		sticky_keys();
-	}
-	redraw();
-}
-
-void Piano_Roll::unpause_following() {
-	_following = true;
-	_paused = false;
-}
-
-void Piano_Roll::stop_following() {
-	_following = false;
-	_paused = false;
-	_tick = -1;
-	_piano_timeline.reset_note_colors();
-	_piano_timeline._keys.reset_channel_pitches();
-	redraw();
-}
-
-void Piano_Roll::pause_following() {
-	_following = false;
-	_paused = true;
-}
-
-void Piano_Roll::highlight_tick(int32_t t) {
-	if (_tick == t) return; // no change
-	_tick = t;
-
-	int scroll_x_before = xposition();
-
-	_piano_timeline.highlight_channel_1_tick(_tick);
-	_piano_timeline.highlight_channel_2_tick(_tick);
-	_piano_timeline.highlight_channel_3_tick(_tick);
-	_piano_timeline.highlight_channel_4_tick(_tick);
-	_piano_timeline._keys.update_key_colors();
-	_piano_timeline._keys.redraw();
-
-	focus_cursor();
-	if (
-		_tick / ticks_per_step() * ticks_per_step() != _piano_timeline._cursor_tick ||
-		xposition() != scroll_x_before
-	) {
-		redraw();
-	}
-}
-
-void Piano_Roll::focus_cursor(bool center) {
-	int x_pos = (_tick / ticks_per_step() * ticks_per_step()) * tick_width();
-	if ((_following && _continuous) || x_pos > xposition() + w() - WHITE_KEY_WIDTH * 2 || x_pos < xposition()) {
-		int scroll_pos = center ? x_pos + WHITE_KEY_WIDTH - w() / 2 : x_pos;
-		scroll_to(std::min(std::max(scroll_pos, 0), scroll_x_max()), yposition());
-		sticky_keys();
-	}
-}
-
-void Piano_Roll::sticky_keys() {
-	_piano_timeline._keys.position(0, _piano_timeline._keys.y());
-}
-
-void Piano_Roll::scroll_to_y_max() {
-	scroll_to(xposition(), scroll_y_max());
-}
-
-void Piano_Roll::scroll_to(int X, int Y) {
-	Fl_Scroll::scroll_to(X, Y);
-}
-
-int Piano_Roll::scroll_x_max() const {
-	return _piano_timeline.w() - (w() - scrollbar.w());
-}
-
-int Piano_Roll::scroll_y_max() const {
-	return _piano_timeline.h() - (h() - hscrollbar.h());
-}
-
-void Piano_Roll::scrollbar_cb(Fl_Scrollbar *sb, void *) {
-	Piano_Roll *scroll = (Piano_Roll *)(sb->parent());
-	scroll->scroll_to(scroll->xposition(), std::min(sb->value(), scroll->scroll_y_max()));
-}
-
-void Piano_Roll::hscrollbar_cb(Fl_Scrollbar *sb, void *) {
-	Piano_Roll *scroll = (Piano_Roll *)(sb->parent());
-	scroll->scroll_to(std::min(sb->value(), scroll->scroll_x_max()), scroll->yposition());
-	scroll->sticky_keys();
-	if (scroll->_following) {
-		scroll->focus_cursor();
-	}
-	scroll->redraw();
-}
-
-class IT_Module {
-private:
-	int32_t _current_tick = 0;
-
-	bool _playing = false;
-	bool _paused = false;
-	int _speed = 1;
-public:
-	IT_Module() {};
-
-	IT_Module(const IT_Module&) = delete;
-	IT_Module& operator=(const IT_Module&) = delete;
-
-	bool ready()   const { return true; }
-	bool playing() const { return _playing; }
-	bool paused()  const { return _paused; }
-	bool stopped() const { return !playing() && !paused(); }
-
-	bool start()   { _paused = false; _playing = true;  return true; }
-	bool stop()    { _paused = false; _playing = false; _current_tick = 0; return true; }
-	bool pause()   { _paused = true;  _playing = false; return true; }
-	void play();
-
-	int32_t current_tick() const { return _current_tick; }
-
-	int speed() const { return _speed; }
-	void speed(int s) { _speed = s; }
-};
-
-void IT_Module::play() {
-	if (!ready() || !playing()) return;
-
-	std::size_t count = 1;
-	_current_tick += _speed;
-	if (_current_tick >= 3072) _current_tick = 0;
-
-	if (count == 0) {
-		stop();
-	}
-}
-
-class Main_Window : public Fl_Double_Window {
-private:
-	Fl_Menu_Bar *_menu_bar;
-	Fl_Menu_Item *_play_pause_mi;
-	Fl_Menu_Item *_stop_mi;
-	Fl_Menu_Item *_continuous_mi;
-	Fl_Menu_Item *_full_screen_mi;
-	Piano_Roll *_piano_roll;
-	Fl_Group *_status_bar;
-	Fl_Box *_speed_label;
-	Fl_Slider *_speed_slider;
-	Fl_Box *_fps_label;
-	IT_Module _it_module;
-	int32_t _tick = -1;
-	bool _sync_requested = false;
-	std::thread _audio_thread;
-	std::mutex _audio_mutex;
-	std::promise<void> _audio_kill_signal;
-	int _frames = 0;
-	int _frames_per_second = 0;
-	time_t _frame_time = time(NULL);
-public:
-	Main_Window(int x, int y, int w, int h, const char *l = nullptr);
-	~Main_Window();
-	void resize(int X, int Y, int W, int H) override;
-	inline bool continuous_scroll() const { return _continuous_mi && !!_continuous_mi->value(); }
-	inline bool full_screen() const { return _full_screen_mi && !!_full_screen_mi->value(); }
-	inline void continuous_scroll(bool c) { _continuous_mi->value(c);  continuous_cb(nullptr, this); }
-
-	inline bool playing() { return _it_module.playing(); }
-	inline bool paused()  { return _it_module.paused(); }
-	inline bool stopped() { return _it_module.stopped(); }
-protected:
-	void draw() override;
-private:
-	void update_active_controls();
-	void toggle_playback();
-	void stop_playback();
-	void start_audio_thread();
-	void stop_audio_thread();
-	void update_layout();
-
-	static void speed_slider_cb(Fl_Widget *w);
-	static void play_pause_cb(Fl_Widget *w, Main_Window *mw);
-	static void stop_cb(Fl_Widget *w, Main_Window *mw);
-	static void continuous_cb(Fl_Widget *w, Main_Window *mw);
-	static void full_screen_cb(Fl_Widget *w, Main_Window *mw);
-	static void playback_thread(Main_Window *mw, std::future<void> kill_signal);
-	static void sync_cb(Main_Window *mw);
-};
-
-constexpr int MENU_BAR_HEIGHT = 21;
-constexpr int STATUS_BAR_HEIGHT = 23;
-
-#ifdef __APPLE__
-#define FULLSCREEN_KEY FL_COMMAND + FL_SHIFT + 'f'
-#else
-#define FULLSCREEN_KEY FL_F + 11
-#endif
-
-Main_Window::Main_Window(int x, int y, int w, int h, const char *) : Fl_Double_Window(x, y, w, h, "Scroll Perf Test") {
-	int wx = 0, wy = 0, ww = w, wh = h;
-
-	_menu_bar = new Fl_Menu_Bar(wx, wy, ww, MENU_BAR_HEIGHT);
-	wy += _menu_bar->h();
-	wh -= _menu_bar->h();
-
-	_status_bar = new Fl_Group(wx, h - STATUS_BAR_HEIGHT, ww, STATUS_BAR_HEIGHT);
-	wh -= _status_bar->h();
-	_status_bar->resizable(nullptr);
-	_speed_label = new Fl_Box(wx, h - STATUS_BAR_HEIGHT, 50, STATUS_BAR_HEIGHT, "Speed:");
-	_speed_slider = new Fl_Slider(wx + 50, h - STATUS_BAR_HEIGHT, 100, STATUS_BAR_HEIGHT);
-	_speed_slider->type(FL_HORIZONTAL);
-	_speed_slider->value(1.0);
-	_speed_slider->bounds(1.0, 10.0);
-	_speed_slider->user_data(this);
-	_speed_slider->callback((Fl_Callback *)speed_slider_cb);
-	_fps_label = new Fl_Box(wx + 150, h - STATUS_BAR_HEIGHT, 100, STATUS_BAR_HEIGHT);
-	_fps_label->box(FL_FLAT_BOX);
-	_status_bar->end();
-	begin();
-
-	_piano_roll = new Piano_Roll(wx, wy, ww, wh);
-
-	Fl_Menu_Item menu_items[] = {
-		{"&Play",              0,              0,                             0,    FL_SUBMENU,                     0, 0, 0, 0},
-		{"&Play/Pause",        ' ',            (Fl_Callback *)play_pause_cb,  this, 0,                              0, 0, 0, 0},
-		{"&Stop",              FL_Escape,      (Fl_Callback *)stop_cb,        this, FL_MENU_DIVIDER,                0, 0, 0, 0},
-		{"&Continuous Scroll", '\\',           (Fl_Callback *)continuous_cb,  this, FL_MENU_TOGGLE | FL_MENU_VALUE, 0, 0, 0, 0},
-		{},
-		{"&View",              0,              0,                             0,    FL_SUBMENU,                     0, 0, 0, 0},
-		{"Full &Screen",       FULLSCREEN_KEY, (Fl_Callback *)full_screen_cb, this, FL_MENU_TOGGLE,                 0, 0, 0, 0},
-		{},
-		{}
-	};
-	_menu_bar->copy(menu_items);
-	_menu_bar->menu_end();
-
-#define FIND_MENU_ITEM_CB(c) (const_cast<Fl_Menu_Item *>(_menu_bar->find_item((Fl_Callback *)(c))))
-	_play_pause_mi = FIND_MENU_ITEM_CB(play_pause_cb);
-	_stop_mi = FIND_MENU_ITEM_CB(stop_cb);
-	_continuous_mi = FIND_MENU_ITEM_CB(continuous_cb);
-	_full_screen_mi = FIND_MENU_ITEM_CB(full_screen_cb);
-#undef FIND_MENU_ITEM_CB
-
-	update_active_controls();
-	update_layout();
-
-	_piano_roll->scroll_to_y_max();
-}
-
-Main_Window::~Main_Window() {
-	stop_audio_thread();
-}
-
-void Main_Window::resize(int X, int Y, int W, int H) {
-	_menu_bar->size(W, MENU_BAR_HEIGHT);
-	_piano_roll->position(0, MENU_BAR_HEIGHT);
-	_piano_roll->set_size(W, H - MENU_BAR_HEIGHT - STATUS_BAR_HEIGHT);
-	_status_bar->resize(0, H - STATUS_BAR_HEIGHT, W, STATUS_BAR_HEIGHT);
-	Fl_Double_Window::resize(X, Y, W, H);
-}
-
-void Main_Window::draw() {
-	Fl_Double_Window::draw();
-
-	_frames += 1;
-	time_t current_time = time(NULL);
-	if (current_time > _frame_time) {
-		_frames_per_second = (_frames_per_second + 3 * _frames / int(current_time - _frame_time)) / 4;
-		_frame_time = current_time;
-		_frames = 0;
-	}
-
-	char s[16];
-	snprintf(s, sizeof(s), "FPS: %d", _frames_per_second);
-	fl_color(FL_FOREGROUND_COLOR);
-	fl_draw(s, _status_bar->x() + 160, _status_bar->y(), 100, _status_bar->h(), FL_ALIGN_LEFT);
-}
-
-void Main_Window::update_active_controls() {
-	bool stopped = this->stopped();
-	_play_pause_mi->activate();
-	if (!stopped) {
-		_stop_mi->activate();
-	}
-	else {
-		_stop_mi->deactivate();
-	}
-
-	_menu_bar->update();
-}
-
-void Main_Window::toggle_playback() {
-	stop_audio_thread();
-
-	if (stopped()) {
-		if (_it_module.ready() && _it_module.start()) {
-			_piano_roll->start_following();
-			start_audio_thread();
-			update_active_controls();
-		}
-		else {
-			return;
-		}
-	}
-	else if (paused()) {
-		if (_it_module.ready() && _it_module.start()) {
-			_piano_roll->unpause_following();
-			start_audio_thread();
-			update_active_controls();
-		}
-		else {
-			return;
-		}
-	}
-	else { // if (playing())
-		_it_module.pause();
-		_piano_roll->pause_following();
-		update_active_controls();
-	}
-}
-
-void Main_Window::stop_playback() {
-	stop_audio_thread();
-
-	if (!_it_module.stopped()) {
-		_it_module.stop();
-		_tick = -1;
-		_piano_roll->stop_following();
-		update_active_controls();
-	}
-}
-
-void Main_Window::start_audio_thread() {
-	_audio_kill_signal = std::promise<void>();
-	std::future<void> kill_future = _audio_kill_signal.get_future();
-	_audio_thread = std::thread(&playback_thread, this, std::move(kill_future));
-}
-
-void Main_Window::stop_audio_thread() {
-	if (_audio_thread.joinable()) {
-		_audio_mutex.lock();
-		_audio_kill_signal.set_value();
-		_audio_thread.join();
-		_audio_mutex.unlock();
-	}
-}
-
-void Main_Window::update_layout() {
-	_piano_roll->position(0, MENU_BAR_HEIGHT);
-	_piano_roll->set_size(w(), h() - MENU_BAR_HEIGHT - STATUS_BAR_HEIGHT);
-	size_range(
-		WHITE_KEY_WIDTH * 3 + Fl::scrollbar_size(),
-		MENU_BAR_HEIGHT + _piano_roll->octave_height() + Fl::scrollbar_size() + STATUS_BAR_HEIGHT,
-		0,
-		MENU_BAR_HEIGHT + _piano_roll->octave_height() * NUM_OCTAVES + Fl::scrollbar_size() + STATUS_BAR_HEIGHT
-	);
-}
-
-void Main_Window::speed_slider_cb(Fl_Widget *w) {
-	Main_Window *mw = (Main_Window *)w->user_data();
-	int speed = (int)mw->_speed_slider->value();
-	if (speed != mw->_it_module.speed()) {
-		mw->_audio_mutex.lock();
-		mw->_it_module.speed(speed);
-		mw->_audio_mutex.unlock();
-	}
-}
-
-void Main_Window::play_pause_cb(Fl_Widget *, Main_Window *mw) {
-	mw->toggle_playback();
-}
-
-void Main_Window::stop_cb(Fl_Widget *, Main_Window *mw) {
-	mw->stop_playback();
-}
-
-void Main_Window::continuous_cb(Fl_Widget *, Main_Window *mw) {
-	mw->_piano_roll->set_continuous_scroll(mw->continuous_scroll());
-	mw->redraw();
-}
-
-void Main_Window::full_screen_cb(Fl_Widget *, Main_Window *mw) {
-	if (mw->full_screen()) {
-		mw->fullscreen();
-	}
-	else {
-		mw->fullscreen_off();
-	}
-}
-
-void Main_Window::playback_thread(Main_Window *mw, std::future<void> kill_signal) {
-	int32_t tick = -1;
-	while (kill_signal.wait_for(std::chrono::milliseconds(8)) == std::future_status::timeout) {
-		if (mw->_audio_mutex.try_lock()) {
-			IT_Module *mod = &mw->_it_module;
-			if (mod && mod->playing()) {
-				mod->play();
-				int32_t t = mod->current_tick();
-				if (tick != t) {
-					tick = t;
-					mw->_tick = t;
-					if (!mw->_sync_requested) {
-						Fl::awake((Fl_Awake_Handler)sync_cb, mw);
-						mw->_sync_requested = true;
-					}
-				}
-				mw->_audio_mutex.unlock();
-			}
-			else {
-				mw->_tick = -1;
-				if (!mw->_sync_requested) {
-					Fl::awake((Fl_Awake_Handler)sync_cb, mw);
-					mw->_sync_requested = true;
-				}
-				mw->_audio_mutex.unlock();
-				break;
-			}
-		}
-	}
-}
-
-void Main_Window::sync_cb(Main_Window *mw) {
-	mw->_audio_mutex.lock();
-	IT_Module *mod = &mw->_it_module;
-	if (mod && mod->playing() && mw->_tick > 0) {
-		mw->_piano_roll->highlight_tick(mw->_tick);
-		mw->_status_bar->redraw();
-	}
-	else if (!mod || mod->stopped()) {
-		mw->_tick = -1;
-		mw->_piano_roll->stop_following();
-		mw->update_active_controls();
-	}
-	mw->_sync_requested = false;
-	mw->_audio_mutex.unlock();
-}
-
-static Main_Window *window = nullptr;
-
-int main(int argc, char **argv) {
-	window = new Main_Window(48, 48, 800, 600);
-	Fl::lock();
-	window->show();
-	return Fl::run();
-}
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <FL/Fl.H>
+#include <FL/fl_draw.H>
+#include <FL/Fl_Window.H>
+#include <FL/Fl_Menu_Bar.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Image.H>
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Scrollbar.H>
+#include <FL/Fl_Slider.H>
+#include <FL/platform.H>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef FLTK_USE_X11
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+enum class Pitch {
+	REST,
+	C_NAT,
+	C_SHARP,
+	D_NAT,
+	D_SHARP,
+	E_NAT,
+	F_NAT,
+	F_SHARP,
+	G_NAT,
+	G_SHARP,
+	A_NAT,
+	A_SHARP,
+	B_NAT,
+};
+
+struct Note_View {
+	int32_t length = 0;
+	Pitch pitch = Pitch::REST;
+	int32_t octave = 0;
+	int32_t speed = 0;
+};
+
+const Fl_Color NOTE_RED   = fl_rgb_color(217,   0,   0);
+const Fl_Color NOTE_BLUE  = fl_rgb_color(  0, 117, 253);
+const Fl_Color NOTE_GREEN = fl_rgb_color(  0, 165,   0);
+const Fl_Color NOTE_BROWN = fl_rgb_color(124,  60,  25);
+
+const Fl_Color NOTE_RED_LIGHT   = fl_lighter(NOTE_RED);
+const Fl_Color NOTE_BLUE_LIGHT  = fl_lighter(NOTE_BLUE);
+const Fl_Color NOTE_GREEN_LIGHT = fl_lighter(NOTE_GREEN);
+const Fl_Color NOTE_BROWN_LIGHT = fl_lighter(NOTE_BROWN);
+
+// a note's state is derived from the highlight tick and picks its color from the channel's palette
+enum Note_State : uint8_t {
+	NOTE_NORMAL,
+	NOTE_PLAYED,
+	NUM_NOTE_STATES
+};
+
+using Note_Palette = std::array<Fl_Color, NUM_NOTE_STATES>;
+
+const Note_Palette NOTE_PALETTES[4] = {
+	{ NOTE_RED,   NOTE_RED_LIGHT },
+	{ NOTE_BLUE,  NOTE_BLUE_LIGHT },
+	{ NOTE_GREEN, NOTE_GREEN_LIGHT },
+	{ NOTE_BROWN, NOTE_BROWN_LIGHT },
+};
+
+constexpr size_t NUM_WHITE_NOTES = 7;
+constexpr size_t NUM_BLACK_NOTES = 5;
+
+constexpr size_t NUM_NOTES_PER_OCTAVE = NUM_WHITE_NOTES + NUM_BLACK_NOTES;
+constexpr size_t NUM_OCTAVES = 8;
+
+constexpr int WHITE_KEY_WIDTH  = 150;
+constexpr int WHITE_KEY_HEIGHT = 24;
+
+constexpr int BLACK_KEY_WIDTH  = 100;
+constexpr int BLACK_KEY_HEIGHT = 20;
+
+constexpr int TICK_WIDTH = 3;
+constexpr int MAX_TICK_WIDTH = 12;
+constexpr int TICKS_PER_STEP = 12;
+
+constexpr int32_t SONG_LENGTH = 3072;
+
+constexpr int32_t OCCUPANCY_BUCKET_TICKS = TICKS_PER_STEP;
+
+struct Channel_Extents {
+	int32_t last_note_tick = -1;
+	int32_t end_tick = 0;
+};
+
+constexpr size_t NUM_NOTE_ROWS = NUM_NOTES_PER_OCTAVE * NUM_OCTAVES;
+
+// converted to device pixels once, since the timeline draws with the scale overridden
+struct Roll_Metrics {
+	float scale = 1.0f;
+	int line_width = 1;
+	std::array<int, NUM_NOTE_ROWS + 1> row_offsets{};
+
+	inline int device(int v) const {
+		int d = (int)(std::abs(v) * scale + 0.001f);
+		return v < 0 ? -d : d;
+	}
+};
+
+template <typename T>
+static inline size_t vector_bytes(const std::vector<T> &v) {
+	return v.capacity() * sizeof(T);
+}
+
+class Framebuffer;
+
+// one XFillRectangles request on X11, an fl_rectf loop elsewhere
+class Rect_Batch {
+private:
+#ifdef FLTK_USE_X11
+	std::vector<XRectangle> _rects;
+#else
+	struct Rect {
+		int x, y, w, h;
+	};
+	std::vector<Rect> _rects;
+#endif
+	int _clip_x0 = 0, _clip_y0 = 0, _clip_x1 = 0, _clip_y1 = 0;
+	Framebuffer *_target = nullptr;
+public:
+	Rect_Batch() { _rects.reserve(256); }
+
+	inline void clip(int X, int Y, int W, int H) { _clip_x0 = X; _clip_y0 = Y; _clip_x1 = X + W; _clip_y1 = Y + H; }
+	inline void target(Framebuffer *fb) { _target = fb; }
+	inline bool empty() const { return _rects.empty(); }
+	inline size_t bytes() const { return vector_bytes(_rects); }
+
+	void add(int X, int Y, int W, int H);
+	void fill(Fl_Color c);
+};
+
+// shared with the X server through MIT-SHM when possible, else drawn with fl_draw_image
+class Framebuffer {
+private:
+	int _x = 0, _y = 0, _w = 0, _h = 0; // region being drawn, in window device pixels
+	int _capacity_w = 0, _capacity_h = 0;
+	uint32_t *_pixels = nullptr;
+	int _stride = 0; // in pixels
+	std::vector<uint32_t> _heap;
+#ifdef FLTK_USE_X11
+	XShmSegmentInfo _shm{};
+	XImage *_image = nullptr;
+	bool _shm_failed = false;
+	bool _put_pending = false;
+#endif
+public:
+	Framebuffer() = default;
+	~Framebuffer();
+
+	Framebuffer(const Framebuffer&) = delete;
+	Framebuffer& operator=(const Framebuffer&) = delete;
+
+	bool shared() const;
+	inline size_t bytes() const { return (size_t)_capacity_w * _capacity_h * sizeof(uint32_t); }
+
+	void begin(int X, int Y, int W, int H);
+	void fill(int X, int Y, int W, int H, Fl_Color c);
+	void present();
+private:
+	uint32_t pixel(Fl_Color c) const;
+	void allocate(int W, int H);
+#ifdef FLTK_USE_X11
+	bool create_shared(int W, int H);
+	void destroy_shared();
+#endif
+};
+
+using Clock = std::chrono::steady_clock;
+
+static inline double elapsed_ms(Clock::time_point start, Clock::time_point end) {
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+class Frame_Stats {
+private:
+	std::vector<double> _samples;
+public:
+	inline size_t count() const { return _samples.size(); }
+	inline void reserve(size_t capacity) { _samples.reserve(capacity); }
+	inline void clear() { _samples.clear(); }
+	inline void add(double ms) {
+		if (_samples.size() < _samples.capacity()) {
+			_samples.push_back(ms);
+		}
+	}
+
+	void print(FILE *f, const char *name) const;
+};
+
+// rendered text as offscreen images, least recently used evicted first
+class Text_Cache {
+private:
+	struct Entry {
+		std::string text;
+		Fl_Font font;
+		Fl_Fontsize size;
+		Fl_Color fg, bg;
+		float scale;
+		int w, h;
+		Fl_Offscreen image;
+		uint64_t last_used;
+	};
+	std::vector<Entry> _entries;
+	uint64_t _clock = 0;
+	size_t _capacity;
+public:
+	Text_Cache(size_t capacity = 64) : _capacity(capacity) { _entries.reserve(capacity); }
+	~Text_Cache() { clear(); }
+
+	Text_Cache(const Text_Cache&) = delete;
+	Text_Cache& operator=(const Text_Cache&) = delete;
+
+	void draw(const char *text, int X, int Y, int W, int H, Fl_Align align, Fl_Font font, Fl_Fontsize size, Fl_Color fg, Fl_Color bg);
+	void clear();
+	size_t bytes() const;
+private:
+	Entry &lookup(const char *text, Fl_Font font, Fl_Fontsize size, Fl_Color fg, Fl_Color bg, float scale);
+};
+
+static Text_Cache text_cache;
+
+// each level also applies the ones before it
+enum class Render_Quality {
+	FULL,
+	NO_NOTE_BORDERS,
+	NO_DIVIDERS,
+	REDUCED_RATE
+};
+
+constexpr double FRAME_BUDGET_MS = 1000.0 / 60.0;
+constexpr int QUALITY_DEGRADE_FRAMES = 8;
+constexpr int QUALITY_RESTORE_FRAMES = 120;
+constexpr double QUALITY_RESTORE_FRACTION = 0.5;
+
+// drops quality after a few slow frames, restores it after many fast ones
+class Quality_Governor {
+private:
+	Render_Quality _quality = Render_Quality::FULL;
+	double _average_ms = 0.0;
+	int _over = 0;
+	int _under = 0;
+	int _changes = 0;
+public:
+	inline Render_Quality quality() const { return _quality; }
+	inline int changes() const { return _changes; }
+	void reset();
+	bool add(double ms);
+};
+
+// in pixels; rectangles merge when the extra area costs less than another region pass
+struct Damage_Costs {
+	// untuned defaults until the --damage-rect-cost/--damage-coverage sweep is run
+	int64_t rect_overhead = 128 * 128;
+	double full_repaint_coverage = 0.6; // fraction of the window
+};
+
+struct Damage_Counters {
+	uint64_t frames = 0;
+	uint64_t rects_added = 0;
+	uint64_t rects_merged = 0;
+	uint64_t region_passes = 0;
+	uint64_t full_repaints = 0;
+};
+
+// regions changed during a frame, repainted as merged passes in flush()
+class Damage_Accumulator {
+public:
+	struct Rect {
+		int x, y, w, h;
+		inline int64_t area() const { return (int64_t)w * h; }
+	};
+private:
+	Fl_Window *_window = nullptr;
+	std::vector<Rect> _rects;
+	int64_t _area = 0;
+	Damage_Costs _costs;
+	Damage_Counters _counters;
+public:
+	Damage_Accumulator() { _rects.reserve(64); }
+
+	Damage_Accumulator(const Damage_Accumulator&) = delete;
+	Damage_Accumulator& operator=(const Damage_Accumulator&) = delete;
+
+	inline void window(Fl_Window *w) { _window = w; }
+	inline bool empty() const { return _rects.empty(); }
+	inline const std::vector<Rect> &rects() const { return _rects; }
+	inline void clear() { _rects.clear(); _area = 0; }
+
+	inline const Damage_Costs &costs() const { return _costs; }
+	inline void costs(const Damage_Costs &c) { _costs = c; }
+	inline Damage_Counters &counters() { return _counters; }
+	inline const Damage_Counters &counters() const { return _counters; }
+
+	void add(int X, int Y, int W, int H);
+	inline void add(const Fl_Widget *w) { add(w->x(), w->y(), w->w(), w->h()); }
+
+	bool full_repaint() const;
+	void print_counters(FILE *f) const;
+};
+
+// runs work at once when no frame is pending, otherwise once before the pending frame draws
+class Frame_Scheduler {
+private:
+	struct Task {
+		Fl_Timeout_Handler handler;
+		void *data;
+	};
+	Fl_Window *_window = nullptr;
+	std::vector<Task> _tasks;
+	std::vector<Task> _running;
+public:
+	Frame_Scheduler() = default;
+
+	Frame_Scheduler(const Frame_Scheduler&) = delete;
+	Frame_Scheduler& operator=(const Frame_Scheduler&) = delete;
+
+	inline void window(Fl_Window *w) { _window = w; }
+
+	void schedule(Fl_Timeout_Handler handler, void *data);
+	void run();
+};
+
+struct Note_Key {
+	int y, delta;
+	Pitch pitch;
+	bool white;
+};
+
+constexpr Note_Key NOTE_KEYS[NUM_NOTES_PER_OCTAVE] {
+	{  0,  0, Pitch::B_NAT,   true },
+	{  1,  0, Pitch::A_NAT,   true },
+	{  2, +1, Pitch::G_NAT,   true },
+	{  3, +1, Pitch::F_NAT,   true },
+	{  4, -1, Pitch::E_NAT,   true },
+	{  5, -1, Pitch::D_NAT,   true },
+	{  6,  0, Pitch::C_NAT,   true },
+	{  1,  0, Pitch::A_SHARP, false },
+	{  3,  0, Pitch::G_SHARP, false },
+	{  5,  0, Pitch::F_SHARP, false },
+	{  8,  0, Pitch::D_SHARP, false },
+	{ 10,  0, Pitch::C_SHARP, false },
+};
+constexpr size_t PITCH_TO_KEY_INDEX[NUM_NOTES_PER_OCTAVE] {
+	6,  // C
+	11, // C#
+	5,  // D
+	10, // D#
+	4,  // E
+	3,  // F
+	9,  // F#
+	2,  // G
+	8,  // G#
+	1,  // A
+	7,  // A#
+	0,  // B
+};
+
+constexpr char const *C_KEY_LABELS[] {
+	"C1",
+	"C2",
+	"C3",
+	"C4",
+	"C5",
+	"C6",
+	"C7",
+	"C8",
+};
+
+struct Channel_Notes {
+	std::vector<Note_View> notes; // rests are folded into the start ticks
+	std::vector<int32_t> ticks;
+	Channel_Extents extents;
+
+	size_t highlighted = 0; // number of notes starting at or before the model's tick
+	Pitch active_pitch = Pitch::REST;
+	int32_t active_octave = 0;
+};
+
+class Note_Model;
+
+class Note_Model_Listener {
+public:
+	virtual ~Note_Model_Listener() = default;
+	virtual void note_model_highlighted(const Note_Model &model) = 0;
+};
+
+// shared by every view; the highlight is computed once per tick for all of them
+class Note_Model {
+private:
+	Channel_Notes _channel_1;
+	Channel_Notes _channel_2;
+	Channel_Notes _channel_3;
+	Channel_Notes _channel_4;
+
+	int32_t _song_length = -1;
+	int32_t _tick = -1;
+
+	// channel bits for each (bucket, note row), for drawing the whole song at once
+	std::vector<uint8_t> _occupancy;
+	size_t _num_buckets = 0;
+
+	std::vector<Note_Model_Listener *> _listeners;
+public:
+	Note_Model() = default;
+
+	Note_Model(const Note_Model&) = delete;
+	Note_Model& operator=(const Note_Model&) = delete;
+
+	inline const Channel_Notes &channel_1() const { return _channel_1; }
+	inline const Channel_Notes &channel_2() const { return _channel_2; }
+	inline const Channel_Notes &channel_3() const { return _channel_3; }
+	inline const Channel_Notes &channel_4() const { return _channel_4; }
+
+	inline int32_t song_length() const { return _song_length; }
+	inline int32_t tick() const { return _tick; }
+	int32_t last_note_tick() const;
+
+	size_t num_notes() const;
+	size_t note_bytes() const;
+	size_t index_bytes() const;
+
+	inline size_t num_buckets() const { return _num_buckets; }
+	inline uint8_t occupancy(size_t bucket, size_t row) const { return _occupancy[bucket * NUM_NOTE_ROWS + row]; }
+
+	void generate(int32_t song_length);
+
+	void add_listener(Note_Model_Listener *l);
+	void remove_listener(Note_Model_Listener *l);
+
+	void highlight_tick(int32_t t);
+	void reset_highlight();
+private:
+	static void generate_channel(Channel_Notes &channel, int channel_number, int32_t song_length);
+	void build_occupancy();
+	void add_occupancy(const Channel_Notes &channel, int channel_number);
+	static void highlight_channel(Channel_Notes &channel, int32_t tick);
+	void notify_listeners();
+};
+
+// the highlight color is looked up from the channels when drawn
+class Key_Box : public Fl_Box {
+private:
+	size_t _index = 0;
+public:
+	Key_Box(size_t i, int X, int Y, int W, int H, const char *l = nullptr) : Fl_Box(X, Y, W, H, l), _index(i) {}
+
+	inline size_t index() const { return _index; }
+	Fl_Color key_color() const;
+protected:
+	void draw() override;
+};
+
+class White_Key_Box : public Key_Box {
+public:
+	using Key_Box::Key_Box;
+protected:
+	void draw() override;
+};
+
+class Piano_Timeline;
+
+class Piano_Keys : public Fl_Group {
+private:
+	std::array<Key_Box *, NUM_NOTES_PER_OCTAVE * NUM_OCTAVES> _keys;
+
+	Pitch   _channel_1_pitch = Pitch::REST;
+	int32_t _channel_1_octave = 0;
+	Pitch   _channel_2_pitch = Pitch::REST;
+	int32_t _channel_2_octave = 0;
+	Pitch   _channel_3_pitch = Pitch::REST;
+	int32_t _channel_3_octave = 0;
+	Pitch   _channel_4_pitch = Pitch::REST;
+	int32_t _channel_4_octave = 0;
+public:
+	Piano_Keys(int X, int Y, int W, int H, const char *l = nullptr);
+
+	Piano_Keys(const Piano_Keys&) = delete;
+	Piano_Keys& operator=(const Piano_Keys&) = delete;
+
+	Piano_Timeline *parent() const { return (Piano_Timeline *)Fl_Group::parent(); }
+
+	void calc_sizes();
+
+	Fl_Color key_color(size_t i, Fl_Color natural) const;
+
+	size_t widget_bytes() const;
+
+	void set_channel_pitch(int channel_number, Pitch p, int32_t o);
+	void reset_channel_pitches();
+private:
+	static size_t key_index(Pitch pitch, int32_t octave);
+	void damage_key(Pitch pitch, int32_t octave);
+};
+
+class Piano_Roll;
+
+class Piano_Timeline : public Fl_Group {
+	friend class Piano_Roll;
+private:
+	Piano_Keys _keys;
+
+	size_t _channel_1_highlighted = 0;
+	size_t _channel_2_highlighted = 0;
+	size_t _channel_3_highlighted = 0;
+	size_t _channel_4_highlighted = 0;
+
+	int32_t _cursor_tick = -1;
+
+	Rect_Batch _border_batch;
+	Rect_Batch _note_batch;
+	Framebuffer _framebuffer;
+public:
+	Piano_Timeline(int X, int Y, int W, int H, const char *l = nullptr);
+	~Piano_Timeline() noexcept;
+
+	Piano_Timeline(const Piano_Timeline&) = delete;
+	Piano_Timeline& operator=(const Piano_Timeline&) = delete;
+
+	Piano_Roll *parent() const { return (Piano_Roll *)Fl_Group::parent(); }
+
+	int64_t content_x() const;
+	int content_y() const;
+	int tick_to_x(int64_t tick) const;
+
+	void highlight_channel_1(const Channel_Notes &c) { highlight_channel(_channel_1_highlighted, 1, c); }
+	void highlight_channel_2(const Channel_Notes &c) { highlight_channel(_channel_2_highlighted, 2, c); }
+	void highlight_channel_3(const Channel_Notes &c) { highlight_channel(_channel_3_highlighted, 3, c); }
+	void highlight_channel_4(const Channel_Notes &c) { highlight_channel(_channel_4_highlighted, 4, c); }
+
+	void reset_note_colors();
+private:
+	void highlight_channel(size_t &highlighted, int channel_number, const Channel_Notes &channel);
+	void note_rect(const Channel_Notes &channel, size_t i, int &X, int &Y, int &W, int &H) const;
+	void draw_channel(const Channel_Notes &channel, size_t highlighted, const Note_Palette &palette, int32_t tick0, int32_t tick1);
+protected:
+	void draw() override;
+};
+
+class Main_Window;
+
+// the timeline draws shifted by the scroll offsets instead of moving its children
+class Piano_Roll : public Fl_Group, public Note_Model_Listener {
+private:
+	int32_t _tick = -1;
+	bool _following = false;
+	bool _continuous = true;
+	bool _paused = false;
+	int _ticks_per_step = TICKS_PER_STEP;
+	int _tick_width = TICK_WIDTH;
+
+	Piano_Timeline _piano_timeline;
+	Fl_Scrollbar _scrollbar;
+	Fl_Scrollbar _hscrollbar;
+
+	int64_t _scroll_x = 0;
+	int _scroll_y = 0;
+	int64_t _content_w = 0;
+	// content pixels per horizontal scrollbar step
+	int64_t _hscroll_unit = 1;
+	// latest scrollbar positions not yet applied, or -1
+	int64_t _target_x = -1;
+	int _target_y = -1;
+
+	std::shared_ptr<Note_Model> _note_model;
+
+	int32_t _seek_tick = -1;
+
+	Damage_Accumulator *_damage = nullptr;
+	Frame_Scheduler *_frame_scheduler = nullptr;
+
+	Roll_Metrics _metrics;
+
+	Render_Quality _quality = Render_Quality::FULL;
+	bool _cpu_render = false;
+public:
+	Piano_Roll(int X, int Y, int W, int H, const char *l = nullptr);
+	~Piano_Roll() noexcept;
+
+	Piano_Roll(const Piano_Roll&) = delete;
+	Piano_Roll& operator=(const Piano_Roll&) = delete;
+
+	Main_Window *parent() const { return (Main_Window *)Fl_Group::parent(); }
+
+	inline int32_t tick() const { return _tick; }
+	inline bool following() const { return _following; }
+	inline bool paused() const { return _paused; }
+	inline int ticks_per_step() const { return _ticks_per_step; }
+
+	int white_key_height() const;
+	int black_key_height() const;
+	int octave_height() const;
+	int note_row_height() const;
+	int black_key_offset() const;
+	int tick_width() const;
+
+	void set_tick_width(int tw);
+
+	inline int64_t xposition() const { return _scroll_x; }
+	inline int yposition() const { return _scroll_y; }
+	inline int viewport_w() const { return w() - _scrollbar.w(); }
+	inline int viewport_h() const { return h() - _hscrollbar.h(); }
+	inline int64_t content_w() const { return _content_w; }
+	inline int64_t tick_x(int64_t tick) const { return WHITE_KEY_WIDTH + tick * _tick_width; }
+	inline int content_h() const { return NUM_OCTAVES * octave_height(); }
+
+	inline Render_Quality render_quality() const { return _quality; }
+	inline bool cpu_render() const { return _cpu_render; }
+	inline void cpu_render(bool c) { _cpu_render = c; redraw(); }
+	void set_render_quality(Render_Quality q);
+
+	inline const Roll_Metrics &metrics() const { return _metrics; }
+	void calc_metrics(float scale);
+
+	inline void damage_accumulator(Damage_Accumulator *d) { _damage = d; }
+	void damage_rect(int X, int Y, int W, int H);
+	size_t widget_bytes() const;
+	size_t cache_bytes() const;
+	size_t offscreen_bytes() const;
+	void damage_widget(Fl_Widget *wgt);
+	void damage_tick_column(int32_t tick);
+
+	inline void frame_scheduler(Frame_Scheduler *s) { _frame_scheduler = s; }
+	inline const std::shared_ptr<Note_Model> &note_model() const { return _note_model; }
+	void set_note_model(std::shared_ptr<Note_Model> model);
+	void note_model_highlighted(const Note_Model &model) override;
+
+	void set_continuous_scroll(bool c) { _continuous = c; }
+
+	void set_size(int W, int H);
+	void set_timeline_width();
+
+	int64_t get_last_note_x() const;
+
+	void start_following();
+	void unpause_following();
+	void stop_following();
+	void pause_following();
+	void follow_tick(int32_t t);
+	void focus_cursor(bool center = false);
+	void scroll_to_tick(int32_t t);
+	int32_t take_seek_tick();
+	int32_t first_visible_tick() const;
+	int32_t last_visible_tick() const;
+	void sticky_keys();
+
+	void scroll_to_y_max();
+	void scroll_to(int64_t X, int Y);
+
+	int64_t scroll_x_max() const;
+	int scroll_y_max() const;
+
+	void resize(int X, int Y, int W, int H) override;
+	int handle(int event) override;
+protected:
+	void draw() override;
+private:
+	void layout_children();
+	void update_scrollbars();
+	void schedule_scroll();
+	void apply_scroll();
+
+	static void apply_scroll_cb(Piano_Roll *p);
+	static void scrollbar_cb(Fl_Scrollbar *sb, void *);
+	static void hscrollbar_cb(Fl_Scrollbar *sb, void *);
+};
+
+// the song image is only rebuilt when the strip is resized
+class Piano_Overview : public Fl_Widget, public Note_Model_Listener {
+private:
+	std::shared_ptr<Note_Model> _note_model;
+	const Piano_Roll *_piano_roll = nullptr;
+
+	std::vector<uchar> _pixels;
+	Fl_RGB_Image *_image = nullptr;
+
+	int _playhead_x = -1;
+	int _viewport_left = -1;
+	int _viewport_right = -1;
+	int32_t _seek_tick = -1;
+
+	Damage_Accumulator *_damage = nullptr;
+public:
+	Piano_Overview(int X, int Y, int W, int H, const char *l = nullptr);
+	~Piano_Overview() noexcept;
+
+	Piano_Overview(const Piano_Overview&) = delete;
+	Piano_Overview& operator=(const Piano_Overview&) = delete;
+
+	inline int32_t seek_tick() const { return _seek_tick; }
+
+	void set_note_model(std::shared_ptr<Note_Model> model);
+	void set_piano_roll(const Piano_Roll *p) { _piano_roll = p; redraw(); }
+	inline void damage_accumulator(Damage_Accumulator *d) { _damage = d; }
+	void note_model_highlighted(const Note_Model &model) override;
+	void viewport_changed();
+
+	inline size_t image_bytes() const { return vector_bytes(_pixels); }
+
+	void resize(int X, int Y, int W, int H) override;
+	int handle(int event) override;
+protected:
+	void draw() override;
+private:
+	void delete_image();
+	void render_image(int W, int H);
+	void damage_viewport(int left, int right);
+	int tick_to_x(int32_t tick) const;
+	int32_t x_to_tick(int X) const;
+};
+
+static inline bool is_white_key(size_t i) {
+	return !(i == 1 || i == 3 || i == 5 || i == 8 || i == 10);
+}
+
+void Damage_Accumulator::add(int X, int Y, int W, int H) {
+	if (!_window) return;
+	// window-relative coordinates, clipped to the window
+	int x0 = std::max(X, 0), y0 = std::max(Y, 0);
+	int x1 = std::min(X + W, _window->w()), y1 = std::min(Y + H, _window->h());
+	if (x0 >= x1 || y0 >= y1) return;
+
+	if (_rects.empty()) {
+		_window->damage(FL_DAMAGE_USER1);
+	}
+	_counters.rects_added += 1;
+
+	// merge with any rectangle whose bounding box is cheaper to paint than two separate passes
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		const int64_t area = (int64_t)(x1 - x0) * (y1 - y0);
+		for (size_t i = 0; i < _rects.size(); ++i) {
+			const Rect &r = _rects[i];
+			int ux0 = std::min(x0, r.x), uy0 = std::min(y0, r.y);
+			int ux1 = std::max(x1, r.x + r.w), uy1 = std::max(y1, r.y + r.h);
+			if ((int64_t)(ux1 - ux0) * (uy1 - uy0) <= area + r.area() + _costs.rect_overhead) {
+				x0 = ux0;
+				y0 = uy0;
+				x1 = ux1;
+				y1 = uy1;
+				_area -= r.area();
+				_rects[i] = _rects.back();
+				_rects.pop_back();
+				_counters.rects_merged += 1;
+				merged = true;
+				break;
+			}
+		}
+	}
+	_rects.push_back({ x0, y0, x1 - x0, y1 - y0 });
+	_area += _rects.back().area();
+}
+
+bool Damage_Accumulator::full_repaint() const {
+	if (!_window || _rects.empty()) return false;
+	// region passes are not free, so charge each one its overhead before comparing with the window
+	int64_t cost = _area + (int64_t)_rects.size() * _costs.rect_overhead;
+	return cost >= (int64_t)(_costs.full_repaint_coverage * _window->w() * _window->h());
+}
+
+void Damage_Accumulator::print_counters(FILE *f) const {
+	fprintf(
+		f, "damage: rect_cost=%lld coverage=%.2f frames=%llu rects=%llu merged=%llu region_passes=%llu full_repaints=%llu\n",
+		(long long)_costs.rect_overhead, _costs.full_repaint_coverage, (unsigned long long)_counters.frames, (unsigned long long)_counters.rects_added,
+		(unsigned long long)_counters.rects_merged, (unsigned long long)_counters.region_passes,
+		(unsigned long long)_counters.full_repaints
+	);
+}
+
+void Frame_Scheduler::schedule(Fl_Timeout_Handler handler, void *data) {
+	if (!_window || !_window->damage()) {
+		handler(data);
+		return;
+	}
+	for (const Task &t : _tasks) {
+		if (t.handler == handler && t.data == data) return;
+	}
+	_tasks.push_back({ handler, data });
+}
+
+void Frame_Scheduler::run() {
+	// tasks may schedule more work while they run
+	_running.swap(_tasks);
+	for (const Task &t : _running) {
+		t.handler(t.data);
+	}
+	_running.clear();
+}
+
+void Rect_Batch::add(int X, int Y, int W, int H) {
+	int x0 = std::max(X, _clip_x0), y0 = std::max(Y, _clip_y0);
+	int x1 = std::min(X + W, _clip_x1), y1 = std::min(Y + H, _clip_y1);
+	if (x0 >= x1 || y0 >= y1) return;
+#ifdef FLTK_USE_X11
+	// clipped to the window, so the coordinates fit XRectangle's 16-bit fields
+	_rects.push_back({ (short)x0, (short)y0, (unsigned short)(x1 - x0), (unsigned short)(y1 - y0) });
+#else
+	_rects.push_back({ x0, y0, x1 - x0, y1 - y0 });
+#endif
+}
+
+void Rect_Batch::fill(Fl_Color c) {
+	if (_rects.empty()) return;
+	if (_target) {
+		for (const auto &r : _rects) {
+#ifdef FLTK_USE_X11
+			_target->fill(r.x, r.y, r.width, r.height, c);
+#else
+			_target->fill(r.x, r.y, r.w, r.h, c);
+#endif
+		}
+		_rects.clear();
+		return;
+	}
+	fl_color(c);
+#ifdef FLTK_USE_X11
+	// fl_gc is null when a hybrid build is running on Wayland
+	if (fl_gc) {
+		XFillRectangles(fl_display, fl_window, fl_gc, _rects.data(), (int)_rects.size());
+		_rects.clear();
+		return;
+	}
+	for (const XRectangle &r : _rects) {
+		fl_rectf(r.x, r.y, r.width, r.height);
+	}
+#else
+	for (const Rect &r : _rects) {
+		fl_rectf(r.x, r.y, r.w, r.h);
+	}
+#endif
+	_rects.clear();
+}
+
+Framebuffer::~Framebuffer() {
+#ifdef FLTK_USE_X11
+	destroy_shared();
+#endif
+}
+
+bool Framebuffer::shared() const {
+#ifdef FLTK_USE_X11
+	return _image != nullptr;
+#else
+	return false;
+#endif
+}
+
+uint32_t Framebuffer::pixel(Fl_Color c) const {
+	uchar r, g, b;
+	Fl::get_color(c, r, g, b);
+	if (shared()) {
+		// the shared image was checked to be 0x00RRGGBB in host byte order
+		return (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+	}
+	// fl_draw_image reads R, G, B from each 4-byte pixel
+	const uchar bytes[4] = { r, g, b, 0 };
+	uint32_t p;
+	memcpy(&p, bytes, sizeof(p));
+	return p;
+}
+
+void Framebuffer::allocate(int W, int H) {
+	// round up like the back buffer so small resizes reuse the same memory
+	W = (W + 255) / 256 * 256;
+	H = (H + 255) / 256 * 256;
+#ifdef FLTK_USE_X11
+	destroy_shared();
+	if (create_shared(W, H)) {
+		_capacity_w = W;
+		_capacity_h = H;
+		return;
+	}
+#endif
+	_heap.assign((size_t)W * H, 0);
+	_pixels = _heap.data();
+	_stride = W;
+	_capacity_w = W;
+	_capacity_h = H;
+}
+
+#ifdef FLTK_USE_X11
+static bool shm_error = false;
+
+static int shm_error_handler(Display *, XErrorEvent *) {
+	shm_error = true;
+	return 0;
+}
+
+bool Framebuffer::create_shared(int W, int H) {
+	if (_shm_failed || !fl_display || !fl_gc || !fl_visual || !XShmQueryExtension(fl_display)) {
+		return false;
+	}
+	const uint16_t one = 1;
+	const int host_order = *(const uint8_t *)&one ? LSBFirst : MSBFirst;
+	_image = XShmCreateImage(fl_display, fl_visual->visual, fl_visual->depth, ZPixmap, nullptr, &_shm, W, H);
+	if (
+		!_image || _image->bits_per_pixel != 32 || _image->byte_order != host_order ||
+		_image->red_mask != 0xff0000 || _image->green_mask != 0x00ff00 || _image->blue_mask != 0x0000ff
+	) {
+		if (_image) XDestroyImage(_image);
+		_image = nullptr;
+		_shm_failed = true;
+		return false;
+	}
+	_shm.shmid = shmget(IPC_PRIVATE, (size_t)_image->bytes_per_line * H, IPC_CREAT | 0600);
+	if (_shm.shmid < 0) {
+		XDestroyImage(_image);
+		_image = nullptr;
+		_shm_failed = true;
+		return false;
+	}
+	_shm.shmaddr = _image->data = (char *)shmat(_shm.shmid, nullptr, 0);
+	if (_shm.shmaddr == (char *)-1) {
+		shmctl(_shm.shmid, IPC_RMID, nullptr);
+		_image->data = nullptr;
+		XDestroyImage(_image);
+		_image = nullptr;
+		_shm_failed = true;
+		return false;
+	}
+	_shm.readOnly = False;
+
+	// attaching fails on a remote display; catch the error instead of letting Xlib exit
+	shm_error = false;
+	XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+	XShmAttach(fl_display, &_shm);
+	XSync(fl_display, False);
+	XSetErrorHandler(old_handler);
+	// the segment is freed once both sides detach
+	shmctl(_shm.shmid, IPC_RMID, nullptr);
+	if (shm_error) {
+		shmdt(_shm.shmaddr);
+		_image->data = nullptr;
+		XDestroyImage(_image);
+		_image = nullptr;
+		_shm_failed = true;
+		return false;
+	}
+
+	_pixels = (uint32_t *)_image->data;
+	_stride = _image->bytes_per_line / 4;
+	_heap.clear();
+	_heap.shrink_to_fit();
+	return true;
+}
+
+void Framebuffer::destroy_shared() {
+	if (!_image) return;
+	XShmDetach(fl_display, &_shm);
+	XSync(fl_display, False);
+	shmdt(_shm.shmaddr);
+	_image->data = nullptr;
+	XDestroyImage(_image);
+	_image = nullptr;
+	_pixels = nullptr;
+	_put_pending = false;
+}
+#endif
+
+void Framebuffer::begin(int X, int Y, int W, int H) {
+	if (W > _capacity_w || H > _capacity_h) {
+		allocate(std::max(W, _capacity_w), std::max(H, _capacity_h));
+	}
+#ifdef FLTK_USE_X11
+	// the server may still be reading the last frame out of shared memory
+	if (_put_pending) {
+		XSync(fl_display, False);
+		_put_pending = false;
+	}
+#endif
+	_x = X;
+	_y = Y;
+	_w = W;
+	_h = H;
+}
+
+void Framebuffer::fill(int X, int Y, int W, int H, Fl_Color c) {
+	int x0 = std::max(X - _x, 0), y0 = std::max(Y - _y, 0);
+	int x1 = std::min(X + W - _x, _w), y1 = std::min(Y + H - _y, _h);
+	if (x0 >= x1 || y0 >= y1) return;
+	const uint32_t p = pixel(c);
+	for (int row = y0; row < y1; ++row) {
+		std::fill_n(_pixels + (size_t)row * _stride + x0, x1 - x0, p);
+	}
+}
+
+void Framebuffer::present() {
+	if (_w <= 0 || _h <= 0) return;
+#ifdef FLTK_USE_X11
+	if (_image) {
+		XShmPutImage(fl_display, fl_window, fl_gc, _image, 0, 0, _x, _y, _w, _h, False);
+		_put_pending = true;
+		return;
+	}
+#endif
+	fl_draw_image((const uchar *)_pixels, _x, _y, _w, _h, 4, _stride * 4);
+}
+
+void Text_Cache::clear() {
+	for (Entry &e : _entries) {
+		fl_delete_offscreen(e.image);
+	}
+	_entries.clear();
+}
+
+// offscreens are allocated in device pixels
+size_t Text_Cache::bytes() const {
+	size_t n = vector_bytes(_entries);
+	for (const Entry &e : _entries) {
+		n += (size_t)(e.w * e.scale) * (size_t)(e.h * e.scale) * 4;
+	}
+	return n;
+}
+
+Text_Cache::Entry &Text_Cache::lookup(const char *text, Fl_Font font, Fl_Fontsize size, Fl_Color fg, Fl_Color bg, float scale) {
+	_clock += 1;
+	for (Entry &e : _entries) {
+		if (e.font == font && e.size == size && e.fg == fg && e.bg == bg && e.scale == scale && e.text == text) {
+			e.last_used = _clock;
+			return e;
+		}
+	}
+
+	Entry *entry;
+	if (_entries.size() < _capacity) {
+		_entries.emplace_back();
+		entry = &_entries.back();
+	}
+	else {
+		entry = &*std::min_element(_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b) {
+			return a.last_used < b.last_used;
+		});
+		fl_delete_offscreen(entry->image);
+	}
+
+	fl_font(font, size);
+	int w = 0, h = 0;
+	fl_measure(text, w, h, 0);
+	entry->text = text;
+	entry->font = font;
+	entry->size = size;
+	entry->fg = fg;
+	entry->bg = bg;
+	entry->scale = scale;
+	entry->w = std::max(w, 1);
+	entry->h = std::max(h, 1);
+	entry->image = fl_create_offscreen(entry->w, entry->h);
+	entry->last_used = _clock;
+
+	fl_begin_offscreen(entry->image);
+	fl_rectf(0, 0, entry->w, entry->h, bg);
+	fl_color(fg);
+	fl_font(font, size);
+	fl_draw(text, 0, 0, entry->w, entry->h, FL_ALIGN_LEFT, nullptr, 0);
+	fl_end_offscreen();
+	return *entry;
+}
+
+void Text_Cache::draw(const char *text, int X, int Y, int W, int H, Fl_Align align, Fl_Font font, Fl_Fontsize size, Fl_Color fg, Fl_Color bg) {
+	if (!text || !*text) return;
+	Fl_Window *win = Fl_Window::current();
+	float scale = win ? Fl::screen_scale(win->screen_num()) : 1.0f;
+	const Entry &e = lookup(text, font, size, fg, bg, scale);
+	int tx = X + (W - e.w) / 2;
+	if (align & FL_ALIGN_LEFT) {
+		tx = X;
+	}
+	else if (align & FL_ALIGN_RIGHT) {
+		tx = X + W - e.w;
+	}
+	int ty = Y + (H - e.h) / 2;
+	fl_copy_offscreen(tx, ty, e.w, e.h, e.image, 0, 0);
+}
+
+void Quality_Governor::reset() {
+	_quality = Render_Quality::FULL;
+	_average_ms = 0.0;
+	_over = 0;
+	_under = 0;
+}
+
+bool Quality_Governor::add(double ms) {
+	_average_ms += (ms - _average_ms) * 0.25;
+	if (_average_ms > FRAME_BUDGET_MS) {
+		_over += 1;
+		_under = 0;
+	}
+	else if (_average_ms < FRAME_BUDGET_MS * QUALITY_RESTORE_FRACTION) {
+		_under += 1;
+		_over = 0;
+	}
+	else {
+		_over = 0;
+		_under = 0;
+	}
+
+	Render_Quality q = _quality;
+	if (_over >= QUALITY_DEGRADE_FRAMES && _quality != Render_Quality::REDUCED_RATE) {
+		q = (Render_Quality)((int)_quality + 1);
+	}
+	else if (_under >= QUALITY_RESTORE_FRAMES && _quality != Render_Quality::FULL) {
+		q = (Render_Quality)((int)_quality - 1);
+	}
+	if (q == _quality) return false;
+	_quality = q;
+	_over = 0;
+	_under = 0;
+	_changes += 1;
+	return true;
+}
+
+void Frame_Stats::print(FILE *f, const char *name) const {
+	if (_samples.empty()) {
+		fprintf(f, "%s: no samples\n", name);
+		return;
+	}
+	std::vector<double> sorted(_samples);
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (double ms : sorted) {
+		total += ms;
+	}
+	const auto percentile = [&](double p) {
+		return sorted[std::min((size_t)(p * sorted.size()), sorted.size() - 1)];
+	};
+	fprintf(
+		f, "%s (ms): n=%zu mean=%.3f p50=%.3f p95=%.3f p99=%.3f max=%.3f\n",
+		name, sorted.size(), total / sorted.size(), percentile(0.50), percentile(0.95), percentile(0.99), sorted.back()
+	);
+}
+
+size_t Note_Model::num_notes() const {
+	return _channel_1.notes.size() + _channel_2.notes.size() + _channel_3.notes.size() + _channel_4.notes.size();
+}
+
+size_t Note_Model::note_bytes() const {
+	return sizeof(*this) + vector_bytes(_channel_1.notes) + vector_bytes(_channel_2.notes) +
+		vector_bytes(_channel_3.notes) + vector_bytes(_channel_4.notes);
+}
+
+// the start ticks are searched for the visible range, the occupancy summary draws the overview
+size_t Note_Model::index_bytes() const {
+	return vector_bytes(_channel_1.ticks) + vector_bytes(_channel_2.ticks) +
+		vector_bytes(_channel_3.ticks) + vector_bytes(_channel_4.ticks) + vector_bytes(_occupancy);
+}
+
+int32_t Note_Model::last_note_tick() const {
+	return std::max({
+		_channel_1.extents.last_note_tick,
+		_channel_2.extents.last_note_tick,
+		_channel_3.extents.last_note_tick,
+		_channel_4.extents.last_note_tick,
+	});
+}
+
+void Note_Model::generate(int32_t song_length) {
+	_song_length = song_length;
+	_tick = -1;
+	generate_channel(_channel_1, 1, song_length);
+	generate_channel(_channel_2, 2, song_length);
+	generate_channel(_channel_3, 3, song_length);
+	generate_channel(_channel_4, 4, song_length);
+	build_occupancy();
+}
+
+void Note_Model::generate_channel(Channel_Notes &channel, int channel_number, int32_t song_length) {
+	channel = Channel_Notes();
+
+	int32_t tick = 0;
+
+	Note_View note;
+
+	while (tick < song_length - 16) {
+		note.octave = channel_number;
+		note.speed = rand() % 4 + 1;
+		note.length = rand() % 4 + 1;
+		note.pitch = (Pitch)(rand() % 12 + 1);
+		if (note.pitch != Pitch::REST) {
+			channel.notes.push_back(note);
+			channel.ticks.push_back(tick);
+			channel.extents.last_note_tick = tick;
+		}
+		tick += note.length * note.speed;
+	}
+	channel.extents.end_tick = tick;
+}
+
+void Note_Model::build_occupancy() {
+	int32_t length = std::max({
+		_song_length,
+		_channel_1.extents.end_tick,
+		_channel_2.extents.end_tick,
+		_channel_3.extents.end_tick,
+		_channel_4.extents.end_tick,
+	});
+	_num_buckets = (size_t)std::max((length + OCCUPANCY_BUCKET_TICKS - 1) / OCCUPANCY_BUCKET_TICKS, 1);
+	_occupancy.assign(_num_buckets * NUM_NOTE_ROWS, 0);
+	add_occupancy(_channel_1, 1);
+	add_occupancy(_channel_2, 2);
+	add_occupancy(_channel_3, 3);
+	add_occupancy(_channel_4, 4);
+}
+
+void Note_Model::add_occupancy(const Channel_Notes &channel, int channel_number) {
+	const uint8_t bit = (uint8_t)(1 << (channel_number - 1));
+	for (size_t i = 0; i < channel.notes.size(); ++i) {
+		const Note_View &note = channel.notes[i];
+		int row = ((int)NUM_OCTAVES - note.octave) * (int)NUM_NOTES_PER_OCTAVE + (int)NUM_NOTES_PER_OCTAVE - (int)note.pitch;
+		if (row < 0 || row >= (int)NUM_NOTE_ROWS) continue;
+		size_t first = (size_t)(channel.ticks[i] / OCCUPANCY_BUCKET_TICKS);
+		size_t last = (size_t)((channel.ticks[i] + note.length * note.speed - 1) / OCCUPANCY_BUCKET_TICKS);
+		for (size_t b = first; b <= last && b < _num_buckets; ++b) {
+			_occupancy[b * NUM_NOTE_ROWS + row] |= bit;
+		}
+	}
+}
+
+void Note_Model::add_listener(Note_Model_Listener *l) {
+	_listeners.push_back(l);
+}
+
+void Note_Model::remove_listener(Note_Model_Listener *l) {
+	_listeners.erase(std::remove(_listeners.begin(), _listeners.end(), l), _listeners.end());
+}
+
+void Note_Model::highlight_tick(int32_t t) {
+	if (_tick == t) return; // no change
+	_tick = t;
+
+	highlight_channel(_channel_1, _tick);
+	highlight_channel(_channel_2, _tick);
+	highlight_channel(_channel_3, _tick);
+	highlight_channel(_channel_4, _tick);
+
+	notify_listeners();
+}
+
+void Note_Model::reset_highlight() {
+	highlight_tick(-1);
+}
+
+void Note_Model::highlight_channel(Channel_Notes &channel, int32_t tick) {
+	// binary search the start ticks so that seeking anywhere costs the same as playing forward
+	size_t &i = channel.highlighted;
+	i = std::upper_bound(channel.ticks.begin(), channel.ticks.end(), tick) - channel.ticks.begin();
+
+	channel.active_pitch = Pitch::REST;
+	channel.active_octave = 0;
+	if (i > 0) {
+		const Note_View &note = channel.notes[i - 1];
+		if (channel.ticks[i - 1] + note.length * note.speed > tick) {
+			channel.active_pitch = note.pitch;
+			channel.active_octave = note.octave;
+		}
+	}
+}
+
+void Note_Model::notify_listeners() {
+	for (Note_Model_Listener *l : _listeners) {
+		l->note_model_highlighted(*this);
+	}
+}
+
+Fl_Color Key_Box::key_color() const {
+	return ((const Piano_Keys *)parent())->key_color(_index, color());
+}
+
+void Key_Box::draw() {
+	draw_box(box(), key_color());
+}
+
+void White_Key_Box::draw() {
+	Fl_Color c = key_color();
+	draw_box(box(), c);
+	text_cache.draw(label(), x() + BLACK_KEY_WIDTH, y(), w() - BLACK_KEY_WIDTH, h(), align(), labelfont(), labelsize(), labelcolor(), c);
+}
+
+Piano_Keys::Piano_Keys(int X, int Y, int W, int H, const char *l) : Fl_Group(X, Y, W, H, l) {
+	resizable(nullptr);
+	for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
+		for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
+			size_t i = _y * NUM_NOTES_PER_OCTAVE + _x;
+			if (NOTE_KEYS[_x].white) {
+				_keys[i] = new White_Key_Box(i, X, Y, 0, 0);
+				_keys[i]->box(FL_BORDER_BOX);
+				_keys[i]->color(FL_WHITE);
+				if (NOTE_KEYS[_x].pitch == Pitch::C_NAT) {
+					_keys[i]->label(C_KEY_LABELS[NUM_OCTAVES - _y - 1]);
+				}
+			}
+			else {
+				_keys[i] = new Key_Box(i, X, Y, 0, 0);
+				_keys[i]->box(FL_BORDER_BOX);
+				_keys[i]->color(FL_FOREGROUND_COLOR);
+			}
+		}
+	}
+	end();
+	calc_sizes();
+}
+
+void Piano_Keys::calc_sizes() {
+	const Piano_Roll *piano_roll = parent()->parent();
+	const int white_key_height = piano_roll->white_key_height();
+	const int black_key_height = piano_roll->black_key_height();
+	const int octave_height = piano_roll->octave_height();
+	const int note_row_height = piano_roll->note_row_height();
+	const int black_key_offset = piano_roll->black_key_offset();
+
+	int white_delta = 0, black_delta = 0;
+
+	int y_top = _keys[0]->y();
+
+	for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
+		int y_pos = octave_height * (int)_y;
+		for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
+			size_t i = _y * NUM_NOTES_PER_OCTAVE + _x;
+			int delta = NOTE_KEYS[_x].delta;
+			if (NOTE_KEYS[_x].white) {
+				_keys[i]->resize(
+					_keys[i]->x(),
+					y_top + y_pos + NOTE_KEYS[_x].y * white_key_height + white_delta,
+					WHITE_KEY_WIDTH,
+					white_key_height + delta
+				);
+				white_delta += delta;
+			}
+			else {
+				_keys[i]->resize(
+					_keys[i]->x(),
+					y_top + y_pos + NOTE_KEYS[_x].y * note_row_height + black_key_offset + black_delta,
+					BLACK_KEY_WIDTH,
+					black_key_height + delta
+				);
+				black_delta += delta;
+			}
+		}
+	}
+
+	size(w(), NUM_OCTAVES * octave_height);
+}
+
+size_t Piano_Keys::key_index(Pitch pitch, int32_t octave) {
+	size_t _y = NUM_OCTAVES - octave;
+	size_t _x = PITCH_TO_KEY_INDEX[(size_t)pitch - 1];
+	return _y * NUM_NOTES_PER_OCTAVE + _x;
+}
+
+size_t Piano_Keys::widget_bytes() const {
+	return NUM_WHITE_NOTES * NUM_OCTAVES * sizeof(White_Key_Box) + NUM_BLACK_NOTES * NUM_OCTAVES * sizeof(Key_Box);
+}
+
+Fl_Color Piano_Keys::key_color(size_t i, Fl_Color natural) const {
+	// later channels win when two channels play the same key
+	if (_channel_4_pitch != Pitch::REST && key_index(_channel_4_pitch, _channel_4_octave) == i) {
+		return NOTE_BROWN_LIGHT;
+	}
+	if (_channel_3_pitch != Pitch::REST && key_index(_channel_3_pitch, _channel_3_octave) == i) {
+		return NOTE_GREEN_LIGHT;
+	}
+	if (_channel_2_pitch != Pitch::REST && key_index(_channel_2_pitch, _channel_2_octave) == i) {
+		return NOTE_BLUE_LIGHT;
+	}
+	if (_channel_1_pitch != Pitch::REST && key_index(_channel_1_pitch, _channel_1_octave) == i) {
+		return NOTE_RED_LIGHT;
+	}
+	return natural;
+}
+
+void Piano_Keys::damage_key(Pitch pitch, int32_t octave) {
+	if (pitch != Pitch::REST) {
+		parent()->parent()->damage_widget(_keys[key_index(pitch, octave)]);
+	}
+}
+
+void Piano_Keys::set_channel_pitch(int channel_number, Pitch p, int32_t o) {
+	assert(channel_number >= 1 && channel_number <= 4);
+	Pitch *pitch;
+	int32_t *octave;
+	if (channel_number == 1) {
+		pitch = &_channel_1_pitch;
+		octave = &_channel_1_octave;
+	}
+	else if (channel_number == 2) {
+		pitch = &_channel_2_pitch;
+		octave = &_channel_2_octave;
+	}
+	else if (channel_number == 3) {
+		pitch = &_channel_3_pitch;
+		octave = &_channel_3_octave;
+	}
+	else {
+		pitch = &_channel_4_pitch;
+		octave = &_channel_4_octave;
+	}
+	if (*pitch == p && *octave == o) return;
+	damage_key(*pitch, *octave);
+	*pitch = p;
+	*octave = o;
+	damage_key(p, o);
+}
+
+void Piano_Keys::reset_channel_pitches() {
+	set_channel_pitch(1, Pitch::REST, 0);
+	set_channel_pitch(2, Pitch::REST, 0);
+	set_channel_pitch(3, Pitch::REST, 0);
+	set_channel_pitch(4, Pitch::REST, 0);
+}
+
+Piano_Timeline::Piano_Timeline(int X, int Y, int W, int H, const char *l) :
+	Fl_Group(X, Y, W, H, l),
+	_keys(X, Y, WHITE_KEY_WIDTH, H)
+{
+	resizable(nullptr);
+	clip_children(1);
+	end();
+}
+
+Piano_Timeline::~Piano_Timeline() noexcept {
+	remove(_keys);
+	Fl_Group::clear();
+}
+
+int64_t Piano_Timeline::content_x() const {
+	return x() - parent()->xposition();
+}
+
+int Piano_Timeline::content_y() const {
+	return y() - parent()->yposition();
+}
+
+// clamped just outside the viewport to stay in window system coordinates
+int Piano_Timeline::tick_to_x(int64_t tick) const {
+	int64_t X = content_x() + parent()->tick_x(tick);
+	return (int)std::min(std::max(X, (int64_t)x() - WHITE_KEY_WIDTH), (int64_t)x() + w() + WHITE_KEY_WIDTH);
+}
+
+// note colors are derived from the highlighted counts, so zeroing them is the whole reset
+void Piano_Timeline::reset_note_colors() {
+	_channel_1_highlighted = 0;
+	_channel_2_highlighted = 0;
+	_channel_3_highlighted = 0;
+	_channel_4_highlighted = 0;
+}
+
+void Piano_Timeline::highlight_channel(size_t &highlighted, int channel_number, const Channel_Notes &channel) {
+	_keys.set_channel_pitch(channel_number, channel.active_pitch, channel.active_octave);
+
+	// only the visible notes between what this view last drew and the model's boundary change color
+	const int32_t tick0 = parent()->first_visible_tick(), tick1 = parent()->last_visible_tick() + 1;
+	size_t visible_first = std::upper_bound(channel.ticks.begin(), channel.ticks.end(), tick0) - channel.ticks.begin();
+	if (visible_first > 0) visible_first -= 1;
+	size_t visible_last = std::lower_bound(channel.ticks.begin(), channel.ticks.end(), tick1) - channel.ticks.begin();
+	size_t from = std::max(std::min(highlighted, channel.highlighted), visible_first);
+	size_t to = std::min(std::max(highlighted, channel.highlighted), visible_last);
+	for (size_t i = from; i < to; ++i) {
+		int X, Y, W, H;
+		note_rect(channel, i, X, Y, W, H);
+		parent()->damage_rect(X, Y, W, H);
+	}
+	highlighted = channel.highlighted;
+}
+
+void Piano_Timeline::note_rect(const Channel_Notes &channel, size_t i, int &X, int &Y, int &W, int &H) const {
+	const Note_View &note = channel.notes[i];
+	const int note_row_height = parent()->note_row_height();
+	X = tick_to_x(channel.ticks[i]);
+	Y = content_y() + ((int)NUM_OCTAVES - note.octave) * parent()->octave_height() + ((int)NUM_NOTES_PER_OCTAVE - (int)note.pitch) * note_row_height;
+	W = tick_to_x((int64_t)channel.ticks[i] + note.length * note.speed) - X;
+	H = note_row_height;
+}
+
+// visible notes are found by binary search; call with the scale overridden
+void Piano_Timeline::draw_channel(const Channel_Notes &channel, size_t highlighted, const Note_Palette &palette, int32_t tick0, int32_t tick1) {
+	const Roll_Metrics &m = parent()->metrics();
+	const int lw = m.line_width;
+	const bool borders = parent()->render_quality() < Render_Quality::NO_NOTE_BORDERS;
+	const int Y = m.device(content_y());
+
+	size_t first = std::upper_bound(channel.ticks.begin(), channel.ticks.end(), tick0) - channel.ticks.begin();
+	if (first > 0) first -= 1;
+	size_t last = std::lower_bound(channel.ticks.begin(), channel.ticks.end(), tick1) - channel.ticks.begin();
+
+	const auto batch_run = [&](size_t from, size_t to, Fl_Color color) {
+		for (size_t i = from; i < to; ++i) {
+			const Note_View &note = channel.notes[i];
+			const int x0 = m.device(tick_to_x(channel.ticks[i]));
+			const int x1 = m.device(tick_to_x((int64_t)channel.ticks[i] + note.length * note.speed));
+			const size_t row = ((size_t)NUM_OCTAVES - note.octave) * NUM_NOTES_PER_OCTAVE + (NUM_NOTES_PER_OCTAVE - (size_t)note.pitch);
+			const int y0 = Y + m.row_offsets[row];
+			const int y1 = Y + m.row_offsets[row + 1];
+			if (borders) {
+				_border_batch.add(x0, y0, x1 - x0, y1 - y0);
+				_note_batch.add(x0 + lw, y0 + lw, x1 - x0 - lw * 2, y1 - y0 - lw * 2);
+			}
+			else {
+				_note_batch.add(x0, y0, x1 - x0, y1 - y0);
+			}
+		}
+		_border_batch.fill(FL_BLACK);
+		_note_batch.fill(color);
+	};
+	batch_run(first, std::min(highlighted, last), palette[NOTE_PLAYED]);
+	batch_run(std::max(highlighted, first), last, palette[NOTE_NORMAL]);
+}
+
+void Piano_Timeline::draw() {
+	Fl_Color light_row = FL_LIGHT1;
+	Fl_Color dark_row =FL_DARK2;
+	Fl_Color row_divider = dark_row;
+	Fl_Color col_divider = FL_DARK3;
+	Fl_Color cursor_color = FL_MAGENTA;
+
+	if (damage() & ~FL_DAMAGE_CHILD) {
+		Piano_Roll *p = parent();
+		const Roll_Metrics &m = p->metrics();
+		const int tick_width = p->tick_width();
+		const int ticks_per_step = p->ticks_per_step();
+		const int64_t content_x = this->content_x();
+
+		// only notes inside the clip box are drawn
+		int cx, cy, cw, ch;
+		fl_clip_box(x(), y(), w(), h(), cx, cy, cw, ch);
+		const int32_t tick0 = (int32_t)std::max((cx - content_x - WHITE_KEY_WIDTH) / tick_width, (int64_t)0);
+		const int32_t tick1 = (int32_t)((cx + cw - content_x - WHITE_KEY_WIDTH) / tick_width + 1);
+
+		// draw in device pixels so the graphics driver doesn't rescale every primitive
+		float scale = fl_override_scale();
+		const int X = m.device(x());
+		const int Y = m.device(y());
+		const int W = m.device(x() + w()) - X;
+		const int H = m.device(y() + h()) - Y;
+		const int content_y = m.device(this->content_y());
+		const int lw = m.line_width;
+		const bool dividers = p->render_quality() < Render_Quality::NO_DIVIDERS;
+
+		const int clip_x = m.device(cx), clip_y = m.device(cy);
+		const int clip_w = m.device(cx + cw) - clip_x, clip_h = m.device(cy + ch) - clip_y;
+		Framebuffer *fb = p->cpu_render() && clip_w > 0 && clip_h > 0 ? &_framebuffer : nullptr;
+		if (fb) {
+			fb->begin(clip_x, clip_y, clip_w, clip_h);
+		}
+		const auto fill = [fb](int fx, int fy, int fw, int fh, Fl_Color c) {
+			if (fb) {
+				fb->fill(fx, fy, fw, fh, c);
+			}
+			else {
+				fl_rectf(fx, fy, fw, fh, c);
+			}
+		};
+
+		for (size_t _y = 0; _y < NUM_OCTAVES; ++_y) {
+			for (size_t _x = 0; _x < NUM_NOTES_PER_OCTAVE; ++_x) {
+				size_t row = _y * NUM_NOTES_PER_OCTAVE + _x;
+				int y_pos = content_y + m.row_offsets[row];
+				int row_h = m.row_offsets[row + 1] - m.row_offsets[row];
+				fill(X, y_pos, W, row_h, is_white_key(_x) ? light_row : dark_row);
+				if (dividers && (_x == 0 || _x == 7)) {
+					fill(X, y_pos - lw, W, lw * 2, row_divider);
+				}
+			}
+		}
+
+		// dividers start at the first step inside the viewport
+		int time_step_width = tick_width * ticks_per_step;
+		int64_t first_step = std::max((x() - content_x - WHITE_KEY_WIDTH) / time_step_width, (int64_t)0);
+		for (int64_t step = first_step; dividers && tick_to_x(step * ticks_per_step) < x() + w(); ++step) {
+			fill(m.device(tick_to_x(step * ticks_per_step)) - lw, Y, lw, H, col_divider);
+		}
+
+		_cursor_tick = p->tick();
+		if (_cursor_tick != -1 && (parent()->following() || parent()->paused())) {
+			_cursor_tick = _cursor_tick / ticks_per_step * ticks_per_step;
+		}
+		fill(m.device(tick_to_x(_cursor_tick)) - lw, Y, lw * 2, H, cursor_color);
+
+		if (p->note_model() && cw > 0 && ch > 0) {
+			_border_batch.clip(clip_x, clip_y, clip_w, clip_h);
+			_note_batch.clip(clip_x, clip_y, clip_w, clip_h);
+			_border_batch.target(fb);
+			_note_batch.target(fb);
+			const Note_Model &model = *p->note_model();
+			draw_channel(model.channel_1(), _channel_1_highlighted, NOTE_PALETTES[0], tick0, tick1);
+			draw_channel(model.channel_2(), _channel_2_highlighted, NOTE_PALETTES[1], tick0, tick1);
+			draw_channel(model.channel_3(), _channel_3_highlighted, NOTE_PALETTES[2], tick0, tick1);
+			draw_channel(model.channel_4(), _channel_4_highlighted, NOTE_PALETTES[3], tick0, tick1);
+		}
+		if (fb) {
+			fb->present();
+		}
+
+		fl_restore_scale(scale);
+	}
+	draw_children();
+}
+
+Piano_Roll::Piano_Roll(int X, int Y, int W, int H, const char *l) :
+	Fl_Group(X, Y, W, H, l),
+	_piano_timeline(X, Y, W - Fl::scrollbar_size(), H - Fl::scrollbar_size()),
+	_scrollbar(X + W - Fl::scrollbar_size(), Y, Fl::scrollbar_size(), H - Fl::scrollbar_size()),
+	_hscrollbar(X, Y + H - Fl::scrollbar_size(), W - Fl::scrollbar_size(), Fl::scrollbar_size())
+{
+	resizable(nullptr);
+	end();
+
+	_hscrollbar.type(FL_HORIZONTAL);
+	_scrollbar.callback((Fl_Callback *)scrollbar_cb);
+	_hscrollbar.callback((Fl_Callback *)hscrollbar_cb);
+
+	calc_metrics(1.0f);
+	layout_children();
+}
+
+Piano_Roll::~Piano_Roll() noexcept {
+	if (_note_model) {
+		_note_model->remove_listener(this);
+	}
+	remove(_hscrollbar);
+	remove(_scrollbar);
+	remove(_piano_timeline);
+}
+
+int Piano_Roll::white_key_height() const {
+	return WHITE_KEY_HEIGHT;
+}
+
+int Piano_Roll::black_key_height() const {
+	return BLACK_KEY_HEIGHT;
+}
+
+int Piano_Roll::octave_height() const {
+	return white_key_height() * NUM_WHITE_NOTES;
+}
+
+int Piano_Roll::note_row_height() const {
+	return octave_height() / NUM_NOTES_PER_OCTAVE;
+}
+
+int Piano_Roll::black_key_offset() const {
+	return note_row_height() / 2 - black_key_height() / 2;
+}
+
+int Piano_Roll::tick_width() const {
+	return _tick_width;
+}
+
+void Piano_Roll::set_tick_width(int tw) {
+	if (tw == _tick_width || tw < 1) return;
+	int64_t scroll_tick = xposition() / _tick_width;
+	_tick_width = tw;
+	set_timeline_width();
+	scroll_to(std::min(scroll_tick * _tick_width, scroll_x_max()), yposition());
+	sticky_keys();
+	if (_tick != -1) {
+		focus_cursor(true);
+	}
+	redraw();
+	// the visible ticks change even when the scroll position doesn't
+	do_callback();
+}
+
+void Piano_Roll::calc_metrics(float scale) {
+	_metrics.scale = scale;
+	_metrics.line_width = std::max((int)scale, 1);
+	const int note_row_height = this->note_row_height();
+	for (size_t i = 0; i <= NUM_NOTE_ROWS; ++i) {
+		_metrics.row_offsets[i] = _metrics.device((int)i * note_row_height);
+	}
+}
+
+void Piano_Roll::damage_rect(int X, int Y, int W, int H) {
+	if (!_damage) {
+		redraw();
+		return;
+	}
+	// clip to the viewport so offscreen notes cost nothing
+	int x0 = std::max(X, x()), y0 = std::max(Y, y());
+	int x1 = std::min(X + W, x() + viewport_w()), y1 = std::min(Y + H, y() + viewport_h());
+	if (x0 < x1 && y0 < y1) {
+		_damage->add(x0, y0, x1 - x0, y1 - y0);
+	}
+}
+
+// the timeline, key group and scrollbars are members; only the keys are separate
+size_t Piano_Roll::widget_bytes() const {
+	return sizeof(*this) + _piano_timeline._keys.widget_bytes();
+}
+
+size_t Piano_Roll::cache_bytes() const {
+	return _piano_timeline._border_batch.bytes() + _piano_timeline._note_batch.bytes();
+}
+
+size_t Piano_Roll::offscreen_bytes() const {
+	return _piano_timeline._framebuffer.bytes();
+}
+
+void Piano_Roll::damage_widget(Fl_Widget *wgt) {
+	damage_rect(wgt->x(), wgt->y(), wgt->w(), wgt->h());
+}
+
+void Piano_Roll::damage_tick_column(int32_t tick) {
+	if (tick < 0) return;
+	int cx = _piano_timeline.tick_to_x(tick);
+	damage_rect(cx - 2, y(), 4, h());
+}
+
+void Piano_Roll::set_size(int W, int H) {
+	if (W != w() || H != h()) {
+		bool width_changed = W != w();
+		size(W, H);
+		if (width_changed) {
+			set_timeline_width();
+		}
+		if (xposition() > scroll_x_max()) {
+			scroll_to(scroll_x_max(), yposition());
+			sticky_keys();
+		}
+		if (yposition() > scroll_y_max()) {
+			scroll_to(xposition(), scroll_y_max());
+		}
+		do_callback();
+	}
+}
+
+void Piano_Roll::set_timeline_width() {
+	int32_t song_length = _note_model ? _note_model->song_length() : 0;
+	_content_w = std::max(tick_x(song_length), (int64_t)viewport_w());
+	int64_t last_note_x = get_last_note_x();
+	int64_t width = last_note_x + viewport_w() - WHITE_KEY_WIDTH;
+	if (width > _content_w) {
+		_content_w = width;
+	}
+	update_scrollbars();
+}
+
+void Piano_Roll::set_note_model(std::shared_ptr<Note_Model> model) {
+	if (_note_model) {
+		_note_model->remove_listener(this);
+	}
+	_piano_timeline.reset_note_colors();
+	_note_model = std::move(model);
+	_tick = -1;
+
+	if (_note_model) {
+		_note_model->add_listener(this);
+	}
+
+	set_timeline_width();
+	redraw();
+}
+
+void Piano_Roll::note_model_highlighted(const Note_Model &model) {
+	_piano_timeline.highlight_channel_1(model.channel_1());
+	_piano_timeline.highlight_channel_2(model.channel_2());
+	_piano_timeline.highlight_channel_3(model.channel_3());
+	_piano_timeline.highlight_channel_4(model.channel_4());
+
+	if (model.tick() != -1) {
+		follow_tick(model.tick());
+	}
+}
+
+void Piano_Roll::set_render_quality(Render_Quality q) {
+	if (q == _quality) return;
+	_quality = q;
+	redraw();
+}
+
+int64_t Piano_Roll::get_last_note_x() const {
+	int32_t last_note_tick = _note_model ? _note_model->last_note_tick() : -1;
+	if (last_note_tick == -1) {
+		return 0;
+	}
+	return tick_x(last_note_tick);
+}
+
+void Piano_Roll::start_following() {
+	_following = true;
+	_paused = false;
+	_piano_timeline.reset_note_colors();
+	_piano_timeline._keys.reset_channel_pitches();
+	if (_tick == -1) {
+		scroll_to(0, yposition());
+		sticky_keys();
+	}
+	redraw();
+}
+
+void Piano_Roll::unpause_following() {
+	_following = true;
+	_paused = false;
+}
+
+void Piano_Roll::stop_following() {
+	_following = false;
+	_paused = false;
+	_tick = -1;
+	_piano_timeline.reset_note_colors();
+	_piano_timeline._keys.reset_channel_pitches();
+	redraw();
+}
+
+void Piano_Roll::pause_following() {
+	_following = false;
+	_paused = true;
+}
+
+void Piano_Roll::follow_tick(int32_t t) {
+	if (_tick == t) return; // no change
+	_tick = t;
+
+	int64_t scroll_x_before = xposition();
+
+	focus_cursor();
+	if (xposition() != scroll_x_before) {
+		redraw();
+	}
+	else if (_tick / ticks_per_step() * ticks_per_step() != _piano_timeline._cursor_tick) {
+		damage_tick_column(_piano_timeline._cursor_tick);
+		damage_tick_column(_tick / ticks_per_step() * ticks_per_step());
+	}
+}
+
+void Piano_Roll::focus_cursor(bool center) {
+	int64_t x_pos = tick_x(_tick / ticks_per_step() * ticks_per_step()) - WHITE_KEY_WIDTH;
+	if ((_following && _continuous) || x_pos > xposition() + w() - WHITE_KEY_WIDTH * 2 || x_pos < xposition()) {
+		int64_t scroll_pos = center ? x_pos + WHITE_KEY_WIDTH - w() / 2 : x_pos;
+		scroll_to(std::min(std::max(scroll_pos, (int64_t)0), scroll_x_max()), yposition());
+		sticky_keys();
+	}
+}
+
+void Piano_Roll::scroll_to_tick(int32_t t) {
+	int64_t scroll_pos = tick_x(t) - viewport_w() / 2;
+	scroll_to(std::min(std::max(scroll_pos, (int64_t)0), scroll_x_max()), yposition());
+	sticky_keys();
+	redraw();
+}
+
+int32_t Piano_Roll::take_seek_tick() {
+	int32_t t = _seek_tick;
+	_seek_tick = -1;
+	return t;
+}
+
+int32_t Piano_Roll::first_visible_tick() const {
+	return (int32_t)(xposition() / tick_width());
+}
+
+int32_t Piano_Roll::last_visible_tick() const {
+	return (int32_t)((xposition() + viewport_w() - WHITE_KEY_WIDTH) / tick_width());
+}
+
+// the keys are the only children that follow the scroll, and only vertically
+void Piano_Roll::sticky_keys() {
+	_piano_timeline._keys.position(x(), _piano_timeline.content_y());
+}
+
+void Piano_Roll::scroll_to_y_max() {
+	scroll_to(xposition(), scroll_y_max());
+}
+
+void Piano_Roll::scroll_to(int64_t X, int Y) {
+	if (X != _scroll_x || Y != _scroll_y) {
+		bool vertical = Y != _scroll_y;
+		_scroll_x = X;
+		_scroll_y = Y;
+		if (vertical) {
+			sticky_keys();
+		}
+		update_scrollbars();
+		_piano_timeline.redraw();
+		do_callback();
+	}
+}
+
+int64_t Piano_Roll::scroll_x_max() const {
+	return std::max(content_w() - viewport_w(), (int64_t)0);
+}
+
+int Piano_Roll::scroll_y_max() const {
+	return std::max(content_h() - viewport_h(), 0);
+}
+
+void Piano_Roll::resize(int X, int Y, int W, int H) {
+	Fl_Widget::resize(X, Y, W, H);
+	layout_children();
+}
+
+void Piano_Roll::layout_children() {
+	const int size = Fl::scrollbar_size();
+	_scrollbar.resize(x() + w() - size, y(), size, h() - size);
+	_hscrollbar.resize(x(), y() + h() - size, w() - size, size);
+	_piano_timeline.resize(x(), y(), w() - size, h() - size);
+	sticky_keys();
+	update_scrollbars();
+}
+
+void Piano_Roll::update_scrollbars() {
+	_scrollbar.value(_scroll_y, viewport_h(), 0, std::max(content_h(), viewport_h()));
+	_scrollbar.linesize(note_row_height());
+	// Fl_Scrollbar takes ints, so content wider than that scrolls in coarser steps
+	int64_t total = std::max(content_w(), (int64_t)viewport_w());
+	_hscroll_unit = total / std::numeric_limits<int>::max() + 1;
+	_hscrollbar.value((int)(_scroll_x / _hscroll_unit), (int)(viewport_w() / _hscroll_unit), 0, (int)(total / _hscroll_unit));
+	_hscrollbar.linesize((int)std::max(tick_width() * ticks_per_step() / _hscroll_unit, (int64_t)1));
+}
+
+int Piano_Roll::handle(int event) {
+	// the wheel scrolls the view wherever the pointer is inside it
+	if (event == FL_MOUSEWHEEL) {
+		if (Fl::event_dy() && _scrollbar.handle(event)) return 1;
+		if (Fl::event_dx() && _hscrollbar.handle(event)) return 1;
+	}
+	return Fl_Group::handle(event);
+}
+
+void Piano_Roll::draw() {
+	Fl_Window *win = window();
+	float scale = win ? Fl::screen_scale(win->screen_num()) : 1.0f;
+	if (scale != _metrics.scale) {
+		calc_metrics(scale);
+	}
+	Fl_Group::draw();
+	if (damage() & ~FL_DAMAGE_CHILD) {
+		// the corner between the scrollbars
+		fl_rectf(_hscrollbar.x() + _hscrollbar.w(), _scrollbar.y() + _scrollbar.h(), _scrollbar.w(), _hscrollbar.h(), color());
+	}
+}
+
+void Piano_Roll::schedule_scroll() {
+	if (_frame_scheduler) {
+		_frame_scheduler->schedule((Fl_Timeout_Handler)apply_scroll_cb, this);
+	}
+	else {
+		apply_scroll();
+	}
+}
+
+// applies only the latest scrollbar positions, however many drag events set them
+void Piano_Roll::apply_scroll() {
+	bool horizontal = _target_x != -1;
+	int64_t X = horizontal ? std::min(_target_x, scroll_x_max()) : xposition();
+	int Y = _target_y != -1 ? std::min(_target_y, scroll_y_max()) : yposition();
+	_target_x = -1;
+	_target_y = -1;
+	scroll_to(X, Y);
+	if (horizontal && _following) {
+		// scrolling while playing seeks to the left edge of the view
+		_seek_tick = first_visible_tick();
+		do_callback();
+	}
+}
+
+void Piano_Roll::apply_scroll_cb(Piano_Roll *p) {
+	p->apply_scroll();
+}
+
+void Piano_Roll::scrollbar_cb(Fl_Scrollbar *sb, void *) {
+	Piano_Roll *scroll = (Piano_Roll *)(sb->parent());
+	scroll->_target_y = sb->value();
+	scroll->schedule_scroll();
+}
+
+void Piano_Roll::hscrollbar_cb(Fl_Scrollbar *sb, void *) {
+	Piano_Roll *scroll = (Piano_Roll *)(sb->parent());
+	scroll->_target_x = sb->value() * scroll->_hscroll_unit;
+	scroll->schedule_scroll();
+}
+
+Piano_Overview::Piano_Overview(int X, int Y, int W, int H, const char *l) : Fl_Widget(X, Y, W, H, l) {
+	box(FL_FLAT_BOX);
+	color(FL_DARK2);
+}
+
+Piano_Overview::~Piano_Overview() noexcept {
+	if (_note_model) {
+		_note_model->remove_listener(this);
+	}
+	delete_image();
+}
+
+void Piano_Overview::set_note_model(std::shared_ptr<Note_Model> model) {
+	if (_note_model) {
+		_note_model->remove_listener(this);
+	}
+	_note_model = std::move(model);
+	if (_note_model) {
+		_note_model->add_listener(this);
+	}
+	delete_image();
+	redraw();
+}
+
+void Piano_Overview::note_model_highlighted(const Note_Model &model) {
+	int playhead_x = tick_to_x(model.tick());
+	if (playhead_x == _playhead_x) return;
+	if (!_damage) {
+		redraw();
+		return;
+	}
+	if (_playhead_x != -1) {
+		_damage->add(_playhead_x - 2, y(), 4, h());
+	}
+	if (playhead_x != -1) {
+		_damage->add(playhead_x - 2, y(), 4, h());
+	}
+	_playhead_x = playhead_x;
+}
+
+void Piano_Overview::resize(int X, int Y, int W, int H) {
+	if (W != w() || H != h()) {
+		delete_image();
+	}
+	Fl_Widget::resize(X, Y, W, H);
+}
+
+int Piano_Overview::handle(int event) {
+	switch (event) {
+	case FL_PUSH:
+	case FL_DRAG:
+		if (!_note_model || Fl::event_button() != 1) {
+			return event == FL_DRAG;
+		}
+		_seek_tick = x_to_tick(Fl::event_x());
+		do_callback();
+		return 1;
+	case FL_RELEASE:
+		return 1;
+	}
+	return Fl_Widget::handle(event);
+}
+
+void Piano_Overview::viewport_changed() {
+	if (!_piano_roll) return;
+	int left = tick_to_x(_piano_roll->first_visible_tick());
+	int right = left + std::max(tick_to_x(_piano_roll->last_visible_tick()) - left, 2);
+	if (left == _viewport_left && right == _viewport_right) return;
+	if (!_damage) {
+		redraw();
+		return;
+	}
+	damage_viewport(_viewport_left, _viewport_right);
+	damage_viewport(left, right);
+	_viewport_left = left;
+	_viewport_right = right;
+}
+
+// only the outline is drawn, so only its edges need repainting
+void Piano_Overview::damage_viewport(int left, int right) {
+	if (left < 0 || right <= left) return;
+	_damage->add(left - 2, y(), 4, h());
+	_damage->add(right - 2, y(), 4, h());
+	_damage->add(left, y(), right - left, 2);
+	_damage->add(left, y() + h() - 2, right - left, 2);
+}
+
+void Piano_Overview::draw() {
+	if (!_note_model || _note_model->song_length() <= 0) {
+		draw_box();
+		return;
+	}
+
+	Fl_Window *win = window();
+	float scale = win ? Fl::screen_scale(win->screen_num()) : 1.0f;
+	int image_w = std::max((int)(w() * scale), 1);
+	int image_h = std::max((int)(h() * scale), 1);
+	if (!_image || _image->data_w() != image_w || _image->data_h() != image_h) {
+		render_image(image_w, image_h);
+	}
+	_image->draw(x(), y(), w(), h());
+
+	if (_piano_roll) {
+		_viewport_left = tick_to_x(_piano_roll->first_visible_tick());
+		_viewport_right = _viewport_left + std::max(tick_to_x(_piano_roll->last_visible_tick()) - _viewport_left, 2);
+		fl_rect(_viewport_left, y(), _viewport_right - _viewport_left, h(), FL_FOREGROUND_COLOR);
+	}
+
+	_playhead_x = tick_to_x(_note_model->tick());
+	if (_note_model->tick() != -1) {
+		fl_rectf(_playhead_x - 1, y(), 2, h(), FL_MAGENTA);
+	}
+}
+
+void Piano_Overview::delete_image() {
+	delete _image;
+	_image = nullptr;
+}
+
+void Piano_Overview::render_image(int W, int H) {
+	delete_image();
+
+	const auto rgb = [](Fl_Color c) {
+		std::array<uchar, 3> v;
+		Fl::get_color(c, v[0], v[1], v[2]);
+		return v;
+	};
+	const std::array<uchar, 3> background = rgb(color());
+	const std::array<uchar, 3> channel_colors[4] = { rgb(NOTE_RED), rgb(NOTE_BLUE), rgb(NOTE_GREEN), rgb(NOTE_BROWN) };
+
+	_pixels.assign((size_t)W * H * 3, 0);
+	const size_t num_buckets = _note_model->num_buckets();
+	for (int c = 0; c < W; ++c) {
+		size_t first_bucket = (size_t)c * num_buckets / W;
+		size_t last_bucket = std::max((size_t)(c + 1) * num_buckets / W, first_bucket + 1);
+		for (int r = 0; r < H; ++r) {
+			size_t first_row = (size_t)r * NUM_NOTE_ROWS / H;
+			size_t last_row = std::max((size_t)(r + 1) * NUM_NOTE_ROWS / H, first_row + 1);
+			uint8_t bits = 0;
+			for (size_t b = first_bucket; b < last_bucket; ++b) {
+				for (size_t row = first_row; row < last_row; ++row) {
+					bits |= _note_model->occupancy(b, row);
+				}
+			}
+			const std::array<uchar, 3> *color = &background;
+			for (int channel = 0; channel < 4; ++channel) {
+				if (bits & (1 << channel)) {
+					color = &channel_colors[channel];
+					break;
+				}
+			}
+			uchar *px = &_pixels[((size_t)r * W + c) * 3];
+			px[0] = (*color)[0];
+			px[1] = (*color)[1];
+			px[2] = (*color)[2];
+		}
+	}
+
+	_image = new Fl_RGB_Image(_pixels.data(), W, H, 3);
+	_image->scale(w(), h(), 0, 1);
+}
+
+int Piano_Overview::tick_to_x(int32_t tick) const {
+	int32_t song_length = _note_model ? _note_model->song_length() : 0;
+	if (tick < 0 || song_length <= 0) {
+		return -1;
+	}
+	return x() + (int)((int64_t)tick * w() / song_length);
+}
+
+int32_t Piano_Overview::x_to_tick(int X) const {
+	int32_t song_length = _note_model->song_length();
+	int32_t tick = (int32_t)((int64_t)(X - x()) * song_length / std::max(w(), 1));
+	return std::min(std::max(tick, 0), song_length - 1);
+}
+
+class Status_Value : public Fl_Box {
+private:
+	const char *_format;
+	const char *_none_text;
+	int _value = -1;
+	char _text[32];
+	bool _cached = true;
+	Damage_Accumulator *_damage = nullptr;
+public:
+	Status_Value(int X, int Y, int W, int H, const char *format, const char *none_text = nullptr);
+
+	inline int value() const { return _value; }
+	void value(int v);
+
+	inline void damage_accumulator(Damage_Accumulator *d) { _damage = d; }
+	inline void cached(bool c) { _cached = c; }
+protected:
+	void draw() override;
+private:
+	void format_text();
+};
+
+Status_Value::Status_Value(int X, int Y, int W, int H, const char *format, const char *none_text) :
+	Fl_Box(X, Y, W, H), _format(format), _none_text(none_text)
+{
+	box(FL_FLAT_BOX);
+	format_text();
+}
+
+void Status_Value::format_text() {
+	if (_value < 0 && _none_text) {
+		snprintf(_text, sizeof(_text), "%s", _none_text);
+	}
+	else {
+		snprintf(_text, sizeof(_text), _format, _value);
+	}
+}
+
+void Status_Value::value(int v) {
+	if (v == _value) return;
+	_value = v;
+	format_text();
+	if (_damage) {
+		_damage->add(this);
+	}
+	else {
+		redraw();
+	}
+}
+
+void Status_Value::draw() {
+	draw_box();
+	if (_cached) {
+		text_cache.draw(_text, x() + 10, y(), w() - 10, h(), FL_ALIGN_LEFT, labelfont(), labelsize(), labelcolor(), color());
+	}
+	else {
+		fl_font(labelfont(), labelsize());
+		fl_color(labelcolor());
+		fl_draw(_text, x() + 10, y(), w() - 10, h(), FL_ALIGN_LEFT, nullptr, 0);
+	}
+}
+
+class IT_Module {
+private:
+	int32_t _current_tick = 0;
+
+	bool _playing = false;
+	bool _paused = false;
+	int _speed = 1;
+public:
+	IT_Module() {};
+
+	IT_Module(const IT_Module&) = delete;
+	IT_Module& operator=(const IT_Module&) = delete;
+
+	bool ready()   const { return true; }
+	bool playing() const { return _playing; }
+	bool paused()  const { return _paused; }
+	bool stopped() const { return !playing() && !paused(); }
+
+	bool start()   { _paused = false; _playing = true;  return true; }
+	bool stop()    { _paused = false; _playing = false; _current_tick = 0; return true; }
+	bool pause()   { _paused = true;  _playing = false; return true; }
+	void play();
+
+	int32_t current_tick() const { return _current_tick; }
+	void seek(int32_t tick) { _current_tick = std::min(std::max(tick, 0), SONG_LENGTH - 1); }
+
+	int speed() const { return _speed; }
+	void speed(int s) { _speed = s; }
+};
+
+void IT_Module::play() {
+	if (!ready() || !playing()) return;
+
+	std::size_t count = 1;
+	_current_tick += _speed;
+	if (_current_tick >= SONG_LENGTH) _current_tick = 0;
+
+	if (count == 0) {
+		stop();
+	}
+}
+
+// best effort; a warning is printed when a request is refused
+struct Thread_Scheduling {
+	int cpu = -1;
+	bool realtime = false;
+};
+
+static bool pin_current_thread(int cpu) {
+#if defined(_WIN32)
+	if (cpu < 0 || cpu >= (int)sizeof(DWORD_PTR) * 8) return false;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+	if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+static bool raise_current_thread_priority() {
+#if defined(_WIN32)
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#elif defined(__linux__)
+	sched_param param;
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+	return false;
+#endif
+}
+
+static void apply_thread_scheduling(const Thread_Scheduling &s, const char *name) {
+	if (s.cpu >= 0 && !pin_current_thread(s.cpu)) {
+		fprintf(stderr, "warning: could not pin %s thread to cpu %d\n", name, s.cpu);
+	}
+	if (s.realtime && !raise_current_thread_priority()) {
+		fprintf(stderr, "warning: could not raise %s thread priority; using default scheduling\n", name);
+	}
+}
+
+enum class Transport_Command {
+	PLAY,
+	PAUSE,
+	STOP,
+	SEEK,
+	SPEED,
+	QUIT
+};
+
+struct Transport_Message {
+	Transport_Command command;
+	int32_t value;
+};
+
+// the UI's mirror of the worker's transport, updated as commands are posted
+struct Transport_State {
+	bool playing = false;
+	bool paused = false;
+	int speed = 1;
+};
+
+constexpr auto PLAYBACK_STEP = std::chrono::microseconds(8000);
+constexpr auto STRESS_PLAYBACK_STEP = std::chrono::microseconds(50);
+constexpr auto STRESS_SYNC_DELAY = std::chrono::milliseconds(4);
+// playback time before the allocation check starts counting
+constexpr double ALLOCATION_WARMUP = 2.0;
+
+// input to worker, to sync_cb and to the presented frame
+class Transport_Latency {
+private:
+	uint64_t _command = 0; // serial of the command being measured, 0 if none
+	bool _synced = false;
+	Clock::time_point _input;
+	Frame_Stats _to_worker;
+	Frame_Stats _to_sync;
+	Frame_Stats _to_present;
+public:
+	Transport_Latency();
+
+	inline uint64_t command() const { return _command; }
+	inline bool synced() const { return _synced; }
+
+	void input(uint64_t command);
+	void sync(Clock::time_point applied);
+	void present();
+	void print(FILE *f) const;
+};
+
+Transport_Latency::Transport_Latency() {
+	_to_worker.reserve(1024);
+	_to_sync.reserve(1024);
+	_to_present.reserve(1024);
+}
+
+void Transport_Latency::input(uint64_t command) {
+	_command = command;
+	_synced = false;
+	_input = Clock::now();
+}
+
+void Transport_Latency::sync(Clock::time_point applied) {
+	_to_worker.add(elapsed_ms(_input, applied));
+	_to_sync.add(elapsed_ms(_input, Clock::now()));
+	_synced = true;
+}
+
+void Transport_Latency::present() {
+	if (!_synced) return;
+	_to_present.add(elapsed_ms(_input, Clock::now()));
+	_command = 0;
+	_synced = false;
+}
+
+class Loop_Accounting {
+public:
+	enum Phase {
+		DISPATCH,
+		SYNC,
+		FRAME_TASKS,
+		DRAW,
+		NUM_PHASES
+	};
+private:
+	std::array<double, NUM_PHASES> _ms{};
+	int _awakes = 0;
+	int _frames = 0;
+	Clock::time_point _period_start = Clock::now();
+public:
+	inline void add(Phase p, Clock::time_point start) { _ms[p] += elapsed_ms(start, Clock::now()); }
+	inline void awake() { _awakes += 1; }
+	inline void frame() { _frames += 1; }
+
+	void report(FILE *f);
+};
+
+void Loop_Accounting::report(FILE *f) {
+	static const char *names[NUM_PHASES] = { "dispatch", "sync", "frame_tasks", "draw" };
+	Clock::time_point now = Clock::now();
+	double period = std::max(elapsed_ms(_period_start, now), 1.0);
+	double busy = 0.0;
+	fprintf(f, "loop:");
+	for (int p = 0; p < NUM_PHASES; ++p) {
+		fprintf(f, " %s=%.1f%%", names[p], 100.0 * _ms[p] / period);
+		busy += _ms[p];
+	}
+	const char *verdict = "waiting";
+	if (busy >= 0.85 * period) {
+		verdict = "cpu-bound";
+	}
+	else if (_awakes > 2 * _frames) {
+		verdict = "wakeup-bound";
+	}
+	fprintf(
+		f, " idle=%.1f%% awakes=%d frames=%d -> %s\n",
+		100.0 * std::max(period - busy, 0.0) / period, _awakes, _frames, verdict
+	);
+	_ms.fill(0.0);
+	_awakes = 0;
+	_frames = 0;
+	_period_start = now;
+}
+
+void Transport_Latency::print(FILE *f) const {
+	_to_worker.print(f, "input to worker");
+	_to_sync.print(f, "input to sync");
+	_to_present.print(f, "input to present");
+}
+
+// counts only while enabled; malloc calls from C libraries are not seen
+class Allocation_Tracker {
+public:
+	enum Thread {
+		UI_THREAD,
+		PLAYBACK_THREAD,
+		OTHER_THREAD,
+		NUM_THREADS
+	};
+private:
+	std::atomic<bool> _enabled{ false };
+	std::array<std::atomic<uint64_t>, NUM_THREADS> _allocations{};
+	std::array<std::atomic<uint64_t>, NUM_THREADS> _bytes{};
+	static thread_local Thread _thread;
+	// per-frame counts, updated by the UI thread
+	uint64_t _frame_mark = 0;
+	uint64_t _frames = 0;
+	uint64_t _allocating_frames = 0;
+	uint64_t _max_frame_allocations = 0;
+public:
+	inline bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+	inline void enabled(bool e) { _enabled.store(e, std::memory_order_relaxed); }
+	static inline void current_thread(Thread t) { _thread = t; }
+
+	inline void count(size_t bytes) {
+		if (!enabled()) return;
+		_allocations[_thread].fetch_add(1, std::memory_order_relaxed);
+		_bytes[_thread].fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	inline uint64_t allocations(Thread t) const { return _allocations[t].load(std::memory_order_relaxed); }
+	uint64_t total() const;
+
+	void frame();
+	void reset();
+	void print(FILE *f) const;
+};
+
+thread_local Allocation_Tracker::Thread Allocation_Tracker::_thread = Allocation_Tracker::OTHER_THREAD;
+
+static Allocation_Tracker allocation_tracker;
+
+uint64_t Allocation_Tracker::total() const {
+	uint64_t n = 0;
+	for (const std::atomic<uint64_t> &a : _allocations) {
+		n += a.load(std::memory_order_relaxed);
+	}
+	return n;
+}
+
+// call once per drawn frame; counts what the UI thread allocated since the last one
+void Allocation_Tracker::frame() {
+	uint64_t n = allocations(UI_THREAD);
+	uint64_t frame_allocations = n - _frame_mark;
+	_frame_mark = n;
+	_frames += 1;
+	if (frame_allocations > 0) {
+		_allocating_frames += 1;
+		_max_frame_allocations = std::max(_max_frame_allocations, frame_allocations);
+	}
+}
+
+void Allocation_Tracker::reset() {
+	for (size_t t = 0; t < NUM_THREADS; ++t) {
+		_allocations[t].store(0, std::memory_order_relaxed);
+		_bytes[t].store(0, std::memory_order_relaxed);
+	}
+	_frame_mark = 0;
+	_frames = 0;
+	_allocating_frames = 0;
+	_max_frame_allocations = 0;
+}
+
+void Allocation_Tracker::print(FILE *f) const {
+	static const char *names[NUM_THREADS] = { "ui", "playback", "other" };
+	fprintf(f, "allocations:");
+	for (size_t t = 0; t < NUM_THREADS; ++t) {
+		fprintf(
+			f, " %s=%llu (%llu bytes)", names[t],
+			(unsigned long long)_allocations[t].load(std::memory_order_relaxed),
+			(unsigned long long)_bytes[t].load(std::memory_order_relaxed)
+		);
+	}
+	fprintf(
+		f, " frames=%llu allocating_frames=%llu max_per_frame=%llu\n",
+		(unsigned long long)_frames, (unsigned long long)_allocating_frames, (unsigned long long)_max_frame_allocations
+	);
+}
+
+// the array forms and nothrow overloads forward to these
+void *operator new(size_t size) {
+	allocation_tracker.count(size);
+	if (void *p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+class Main_Window : public Fl_Window {
+private:
+	Fl_Menu_Bar *_menu_bar;
+	Fl_Menu_Item *_play_pause_mi;
+	Fl_Menu_Item *_stop_mi;
+	Fl_Menu_Item *_continuous_mi;
+	Fl_Menu_Item *_full_screen_mi;
+	Fl_Menu_Item *_adaptive_quality_mi;
+	Piano_Roll *_piano_roll;
+	Piano_Overview *_overview;
+	std::shared_ptr<Note_Model> _note_model;
+	Damage_Accumulator _damage;
+	Fl_Group *_status_bar;
+	Fl_Box *_speed_label;
+	Fl_Slider *_speed_slider;
+	Status_Value *_fps_label;
+	Status_Value *_tick_label;
+	Status_Value *_allocs_label;
+	IT_Module _it_module;
+	Transport_State _transport;
+	int32_t _tick = -1;
+	uint64_t _commands_sent = 0;
+	// guarded by _audio_mutex
+	int32_t _worker_tick = -1;
+	uint64_t _commands_applied = 0;
+	Clock::time_point _command_applied_time;
+	std::deque<Transport_Message> _audio_commands;
+	// at most one sync_cb is queued with Fl::awake at a time
+	std::atomic<bool> _sync_pending{ false };
+	std::atomic<int> _awakes_outstanding{ 0 };
+	std::atomic<int> _max_awakes_outstanding{ 0 };
+	std::atomic<uint64_t> _awakes_posted{ 0 };
+	uint64_t _syncs_run = 0;
+	std::chrono::microseconds _playback_step = PLAYBACK_STEP;
+	std::thread _audio_thread;
+	std::mutex _audio_mutex;
+	std::condition_variable _audio_cv;
+	Thread_Scheduling _playback_scheduling;
+	int _frames = 0;
+	int _frames_per_second = 0;
+	time_t _frame_time = time(NULL);
+	Fl_Offscreen _back_buffer = 0;
+	int _back_buffer_w = 0;
+	int _back_buffer_h = 0;
+	float _back_buffer_scale = 0.0f;
+	Frame_Scheduler _frame_scheduler;
+	int _benchmark_seconds = 0;
+	Frame_Stats _frame_times;
+	Frame_Stats _frame_intervals;
+	Clock::time_point _last_frame_end;
+	Transport_Latency _latency;
+	bool _report_latency = false;
+	Loop_Accounting _accounting;
+	Quality_Governor _quality;
+	Clock::time_point _last_highlight;
+	uint64_t _highlight_commands = 0;
+	bool _stress_wakeups = false;
+	uint64_t _allocations_mark = 0;
+	int _allocation_check_seconds = 0;
+	int _exit_code = 0;
+public:
+	Main_Window(int x, int y, int w, int h, const char *l = nullptr);
+	~Main_Window();
+	void resize(int X, int Y, int W, int H) override;
+	void hide() override;
+	inline bool continuous_scroll() const { return _continuous_mi && !!_continuous_mi->value(); }
+	inline bool full_screen() const { return _full_screen_mi && !!_full_screen_mi->value(); }
+	inline void continuous_scroll(bool c) { _continuous_mi->value(c);  continuous_cb(nullptr, this); }
+	inline void full_screen(bool f) { _full_screen_mi->value(f); full_screen_cb(nullptr, this); }
+	inline bool adaptive_quality() const { return _adaptive_quality_mi && !!_adaptive_quality_mi->value(); }
+	inline void adaptive_quality(bool a) { _adaptive_quality_mi->value(a); adaptive_quality_cb(nullptr, this); }
+
+	void start_benchmark(int seconds);
+	inline void damage_costs(const Damage_Costs &c) { _damage.costs(c); }
+	inline void playback_scheduling(const Thread_Scheduling &s) { _playback_scheduling = s; }
+	inline void report_latency(bool r) { _report_latency = r; }
+	inline void cpu_render(bool c) { _piano_roll->cpu_render(c); }
+	inline Loop_Accounting &accounting() { return _accounting; }
+	void start_accounting();
+	void start_wakeup_stress(int seconds);
+	void track_allocations(bool t);
+	void start_allocation_check(int seconds);
+	void print_memory_report(FILE *f);
+	void schedule_memory_report();
+	inline int exit_code() const { return _exit_code; }
+
+	inline bool playing() { return _transport.playing; }
+	inline bool paused()  { return _transport.paused; }
+	inline bool stopped() { return !playing() && !paused(); }
+protected:
+	void flush() override;
+private:
+	void delete_back_buffer();
+	void schedule_layout();
+	void update_active_controls();
+	void toggle_playback();
+	void stop_playback();
+	void start_audio_thread();
+	void stop_audio_thread();
+	void post_command(Transport_Command command, int32_t value = 0);
+	void request_sync();
+	void update_layout();
+	void seek(int32_t tick);
+	void set_tick(int32_t tick);
+
+	static void speed_slider_cb(Fl_Widget *w);
+	static void play_pause_cb(Fl_Widget *w, Main_Window *mw);
+	static void stop_cb(Fl_Widget *w, Main_Window *mw);
+	static void seek_back_cb(Fl_Widget *w, Main_Window *mw);
+	static void seek_forward_cb(Fl_Widget *w, Main_Window *mw);
+	static void seek_start_cb(Fl_Widget *w, Main_Window *mw);
+	static void continuous_cb(Fl_Widget *w, Main_Window *mw);
+	static void full_screen_cb(Fl_Widget *w, Main_Window *mw);
+	static void zoom_in_cb(Fl_Widget *w, Main_Window *mw);
+	static void zoom_out_cb(Fl_Widget *w, Main_Window *mw);
+	static void adaptive_quality_cb(Fl_Widget *w, Main_Window *mw);
+	static void memory_report_cb(Fl_Widget *w, Main_Window *mw);
+	static void piano_roll_cb(Piano_Roll *p, Main_Window *mw);
+	static void overview_cb(Piano_Overview *o, Main_Window *mw);
+	static void playback_thread(Main_Window *mw);
+	static void sync_cb(Main_Window *mw);
+	static void trailing_sync_cb(Main_Window *mw);
+	static void layout_cb(Main_Window *mw);
+	static void benchmark_cb(Main_Window *mw);
+	static void accounting_cb(Main_Window *mw);
+	static void stress_stop_cb(Main_Window *mw);
+	static void stress_check_cb(Main_Window *mw);
+	static void allocation_warmup_cb(Main_Window *mw);
+	static void allocation_check_cb(Main_Window *mw);
+	static void memory_report_timeout_cb(Main_Window *mw);
+};
+
+constexpr int MENU_BAR_HEIGHT = 21;
+constexpr int STATUS_BAR_HEIGHT = 23;
+constexpr int OVERVIEW_HEIGHT = 40;
+
+constexpr int32_t SEEK_STEP_TICKS = TICKS_PER_STEP * 16;
+
+constexpr int BACK_BUFFER_SLACK = 256;
+
+#ifdef __APPLE__
+#define FULLSCREEN_KEY FL_COMMAND + FL_SHIFT + 'f'
+#else
+#define FULLSCREEN_KEY FL_F + 11
+#endif
+
+Main_Window::Main_Window(int x, int y, int w, int h, const char *) : Fl_Window(x, y, w, h, "Scroll Perf Test") {
+	int wx = 0, wy = 0, ww = w, wh = h;
+
+	// children are laid out by hand in resize() and layout_cb()
+	resizable(nullptr);
+
+	_menu_bar = new Fl_Menu_Bar(wx, wy, ww, MENU_BAR_HEIGHT);
+	wy += _menu_bar->h();
+	wh -= _menu_bar->h();
+
+	_status_bar = new Fl_Group(wx, h - STATUS_BAR_HEIGHT, ww, STATUS_BAR_HEIGHT);
+	wh -= _status_bar->h();
+	_status_bar->resizable(nullptr);
+	_speed_label = new Fl_Box(wx, h - STATUS_BAR_HEIGHT, 50, STATUS_BAR_HEIGHT, "Speed:");
+	_speed_slider = new Fl_Slider(wx + 50, h - STATUS_BAR_HEIGHT, 100, STATUS_BAR_HEIGHT);
+	_speed_slider->type(FL_HORIZONTAL);
+	_speed_slider->value(1.0);
+	_speed_slider->bounds(1.0, 10.0);
+	_speed_slider->user_data(this);
+	_speed_slider->callback((Fl_Callback *)speed_slider_cb);
+	_fps_label = new Status_Value(wx + 150, h - STATUS_BAR_HEIGHT, 100, STATUS_BAR_HEIGHT, "FPS: %d");
+	_fps_label->damage_accumulator(&_damage);
+	// a cache miss creates an offscreen, which would allocate during the allocation check
+	_fps_label->cached(false);
+	_fps_label->value(0);
+	_tick_label = new Status_Value(wx + 250, h - STATUS_BAR_HEIGHT, 120, STATUS_BAR_HEIGHT, "Tick: %d", "Tick: -");
+	_tick_label->damage_accumulator(&_damage);
+	// a new value every tick would only churn the text cache
+	_tick_label->cached(false);
+	_allocs_label = new Status_Value(wx + 370, h - STATUS_BAR_HEIGHT, 140, STATUS_BAR_HEIGHT, "Allocs/s: %d");
+	_allocs_label->damage_accumulator(&_damage);
+	_allocs_label->cached(false);
+	_allocs_label->hide();
+	_status_bar->end();
+	begin();
+
+	_overview = new Piano_Overview(wx, h - STATUS_BAR_HEIGHT - OVERVIEW_HEIGHT, ww, OVERVIEW_HEIGHT);
+	wh -= _overview->h();
+
+	_note_model = std::make_shared<Note_Model>();
+	_note_model->generate(SONG_LENGTH);
+
+	_damage.window(this);
+	_frame_scheduler.window(this);
+
+	_piano_roll = new Piano_Roll(wx, wy, ww, wh);
+	_piano_roll->set_note_model(_note_model);
+	_piano_roll->damage_accumulator(&_damage);
+	_piano_roll->frame_scheduler(&_frame_scheduler);
+	_piano_roll->callback((Fl_Callback *)piano_roll_cb, this);
+
+	_overview->set_note_model(_note_model);
+	_overview->damage_accumulator(&_damage);
+	_overview->set_piano_roll(_piano_roll);
+	_overview->callback((Fl_Callback *)overview_cb, this);
+
+	Fl_Menu_Item menu_items[] = {
+		{"&Play",              0,              0,                             0,    FL_SUBMENU,                     0, 0, 0, 0},
+		{"&Play/Pause",        ' ',            (Fl_Callback *)play_pause_cb,  this, 0,                              0, 0, 0, 0},
+		{"&Stop",              FL_Escape,      (Fl_Callback *)stop_cb,        this, FL_MENU_DIVIDER,                0, 0, 0, 0},
+		{"Seek &Back",         FL_COMMAND + FL_Left,  (Fl_Callback *)seek_back_cb,    this, 0,               0, 0, 0, 0},
+		{"Seek &Forward",      FL_COMMAND + FL_Right, (Fl_Callback *)seek_forward_cb, this, 0,               0, 0, 0, 0},
+		{"Seek to St&art",     FL_COMMAND + FL_Home,  (Fl_Callback *)seek_start_cb,   this, FL_MENU_DIVIDER, 0, 0, 0, 0},
+		{"&Continuous Scroll", '\\',           (Fl_Callback *)continuous_cb,  this, FL_MENU_TOGGLE | FL_MENU_VALUE, 0, 0, 0, 0},
+		{},
+		{"&View",              0,              0,                             0,    FL_SUBMENU,                     0, 0, 0, 0},
+		{"Full &Screen",       FULLSCREEN_KEY, (Fl_Callback *)full_screen_cb, this, FL_MENU_TOGGLE | FL_MENU_DIVIDER, 0, 0, 0, 0},
+		{"Zoom &In",           '=',            (Fl_Callback *)zoom_in_cb,     this, 0,                              0, 0, 0, 0},
+		{"Zoom &Out",          '-',            (Fl_Callback *)zoom_out_cb,    this, FL_MENU_DIVIDER,                0, 0, 0, 0},
+		{"&Adaptive Quality",  0,              (Fl_Callback *)adaptive_quality_cb, this, FL_MENU_TOGGLE | FL_MENU_DIVIDER, 0, 0, 0, 0},
+		{"&Memory Report",     0,              (Fl_Callback *)memory_report_cb, this, 0,                            0, 0, 0, 0},
+		{},
+		{}
+	};
+	_menu_bar->copy(menu_items);
+	_menu_bar->menu_end();
+
+#define FIND_MENU_ITEM_CB(c) (const_cast<Fl_Menu_Item *>(_menu_bar->find_item((Fl_Callback *)(c))))
+	_play_pause_mi = FIND_MENU_ITEM_CB(play_pause_cb);
+	_stop_mi = FIND_MENU_ITEM_CB(stop_cb);
+	_continuous_mi = FIND_MENU_ITEM_CB(continuous_cb);
+	_full_screen_mi = FIND_MENU_ITEM_CB(full_screen_cb);
+	_adaptive_quality_mi = FIND_MENU_ITEM_CB(adaptive_quality_cb);
+#undef FIND_MENU_ITEM_CB
+
+	update_active_controls();
+	update_layout();
+
+	_piano_roll->scroll_to_y_max();
+}
+
+Main_Window::~Main_Window() {
+	stop_audio_thread();
+	Fl::remove_timeout((Fl_Timeout_Handler)accounting_cb, this);
+	Fl::remove_timeout((Fl_Timeout_Handler)trailing_sync_cb, this);
+	Fl::remove_timeout((Fl_Timeout_Handler)memory_report_timeout_cb, this);
+	delete_back_buffer();
+}
+
+void Main_Window::resize(int X, int Y, int W, int H) {
+	bool size_changed = W != w() || H != h();
+	Fl_Window::resize(X, Y, W, H);
+	if (size_changed) {
+		// the menu and status bars are cheap; the piano roll is laid out at most once per frame
+		_menu_bar->size(W, MENU_BAR_HEIGHT);
+		_status_bar->resize(0, H - STATUS_BAR_HEIGHT, W, STATUS_BAR_HEIGHT);
+		schedule_layout();
+	}
+}
+
+void Main_Window::hide() {
+	if (_report_latency) {
+		_latency.print(stdout);
+	}
+	delete_back_buffer();
+	text_cache.clear();
+	Fl_Window::hide();
+}
+
+void Main_Window::flush() {
+	// input coalesced while this frame was pending is applied before it draws
+	Clock::time_point tasks_start = Clock::now();
+	_frame_scheduler.run();
+	_accounting.add(Loop_Accounting::FRAME_TASKS, tasks_start);
+	Clock::time_point start = Clock::now();
+	make_current();
+	const int W = w(), H = h();
+	const float scale = Fl::screen_scale(screen_num());
+	if (!_back_buffer || W > _back_buffer_w || H > _back_buffer_h || scale != _back_buffer_scale) {
+		delete_back_buffer();
+		// round up so that growing the window a few pixels at a time keeps reusing the same buffer
+		_back_buffer_w = (W + BACK_BUFFER_SLACK - 1) / BACK_BUFFER_SLACK * BACK_BUFFER_SLACK;
+		_back_buffer_h = (H + BACK_BUFFER_SLACK - 1) / BACK_BUFFER_SLACK * BACK_BUFFER_SLACK;
+		if (scale != _back_buffer_scale) {
+			// cached text was rendered for the old scale
+			text_cache.clear();
+		}
+		_back_buffer_scale = scale;
+		_back_buffer = fl_create_offscreen(_back_buffer_w, _back_buffer_h);
+		clear_damage(FL_DAMAGE_ALL);
+	}
+	const bool drawn = damage() & ~FL_DAMAGE_EXPOSE;
+	if (drawn) {
+		_frames += 1;
+		_accounting.frame();
+		time_t current_time = time(NULL);
+		if (current_time > _frame_time) {
+			_frames_per_second = (_frames_per_second + 3 * _frames / int(current_time - _frame_time)) / 4;
+			_fps_label->value(_frames_per_second);
+			if (allocation_tracker.enabled()) {
+				uint64_t allocations = allocation_tracker.total();
+				_allocs_label->value((int)((allocations - _allocations_mark) / (current_time - _frame_time)));
+				_allocations_mark = allocations;
+			}
+			_frame_time = current_time;
+			_frames = 0;
+		}
+
+		fl_begin_offscreen(_back_buffer);
+		// regular widget damage first, then the regions collected by the accumulator
+		Damage_Counters &counters = _damage.counters();
+		counters.frames += 1;
+		uchar d = damage() & ~FL_DAMAGE_USER1;
+		if (!(d & FL_DAMAGE_ALL) && _damage.full_repaint()) {
+			d = FL_DAMAGE_ALL;
+			counters.full_repaints += 1;
+		}
+		if (d & FL_DAMAGE_ALL) {
+			_damage.clear();
+		}
+		if (d & ~FL_DAMAGE_EXPOSE) {
+			clear_damage(d);
+			draw();
+		}
+		for (const Damage_Accumulator::Rect &r : _damage.rects()) {
+			clear_damage(FL_DAMAGE_ALL);
+			fl_push_clip(r.x, r.y, r.w, r.h);
+			draw();
+			fl_pop_clip();
+			counters.region_passes += 1;
+		}
+		_damage.clear();
+		fl_end_offscreen();
+	}
+	fl_copy_offscreen(0, 0, W, H, _back_buffer, 0, 0);
+	_latency.present();
+	_accounting.add(Loop_Accounting::DRAW, start);
+
+	if (drawn && allocation_tracker.enabled()) {
+		allocation_tracker.frame();
+	}
+
+	if (drawn && adaptive_quality() && _quality.add(elapsed_ms(start, Clock::now()))) {
+		_piano_roll->set_render_quality(_quality.quality());
+	}
+
+	if (_benchmark_seconds > 0) {
+		Clock::time_point end = Clock::now();
+		_frame_times.add(elapsed_ms(start, end));
+		if (_last_frame_end != Clock::time_point()) {
+			_frame_intervals.add(elapsed_ms(_last_frame_end, end));
+		}
+		_last_frame_end = end;
+	}
+}
+
+void Main_Window::delete_back_buffer() {
+	if (_back_buffer) {
+		fl_delete_offscreen(_back_buffer);
+		_back_buffer = 0;
+		_back_buffer_w = 0;
+		_back_buffer_h = 0;
+	}
+}
+
+void Main_Window::schedule_layout() {
+	_frame_scheduler.schedule((Fl_Timeout_Handler)layout_cb, this);
+}
+
+void Main_Window::start_benchmark(int seconds) {
+	_benchmark_seconds = seconds;
+	_frame_times.reserve(seconds * 1000);
+	_frame_intervals.reserve(seconds * 1000);
+	if (stopped()) {
+		toggle_playback();
+	}
+	Fl::add_timeout(seconds, (Fl_Timeout_Handler)benchmark_cb, this);
+}
+
+void Main_Window::start_accounting() {
+	_accounting.report(stdout);
+	Fl::add_timeout(1.0, (Fl_Timeout_Handler)accounting_cb, this);
+}
+
+void Main_Window::accounting_cb(Main_Window *mw) {
+	mw->_accounting.report(stdout);
+	Fl::repeat_timeout(1.0, (Fl_Timeout_Handler)accounting_cb, mw);
+}
+
+void Main_Window::start_wakeup_stress(int seconds) {
+	_stress_wakeups = true;
+	_playback_step = STRESS_PLAYBACK_STEP;
+	_speed_slider->value(_speed_slider->maximum());
+	speed_slider_cb(_speed_slider);
+	if (stopped()) {
+		toggle_playback();
+	}
+	Fl::add_timeout(seconds, (Fl_Timeout_Handler)stress_stop_cb, this);
+}
+
+void Main_Window::track_allocations(bool t) {
+	allocation_tracker.enabled(t);
+	_allocations_mark = allocation_tracker.total();
+	if (t) {
+		_allocs_label->show();
+	}
+	else {
+		_allocs_label->hide();
+	}
+}
+
+// follows playback for a while, then counts allocations over the given time
+void Main_Window::start_allocation_check(int seconds) {
+	_allocation_check_seconds = seconds;
+	track_allocations(true);
+	if (stopped()) {
+		toggle_playback();
+	}
+	Fl::add_timeout(ALLOCATION_WARMUP, (Fl_Timeout_Handler)allocation_warmup_cb, this);
+}
+
+void Main_Window::allocation_warmup_cb(Main_Window *mw) {
+	allocation_tracker.reset();
+	mw->_allocations_mark = 0;
+	Fl::add_timeout(mw->_allocation_check_seconds, (Fl_Timeout_Handler)allocation_check_cb, mw);
+}
+
+void Main_Window::allocation_check_cb(Main_Window *mw) {
+	uint64_t ui = allocation_tracker.allocations(Allocation_Tracker::UI_THREAD);
+	uint64_t playback = allocation_tracker.allocations(Allocation_Tracker::PLAYBACK_THREAD);
+	bool ok = ui == 0 && playback == 0 && mw->playing();
+	allocation_tracker.print(stdout);
+	printf("check-allocations: %d s, playing=%s -> %s\n", mw->_allocation_check_seconds, mw->playing() ? "yes" : "no", ok ? "ok" : "FAILED");
+	mw->_exit_code = ok ? 0 : 1;
+	mw->stop_playback();
+	mw->hide();
+}
+
+static int count_widgets(Fl_Widget *wgt) {
+	int n = 1;
+	if (Fl_Group *g = wgt->as_group()) {
+		for (int i = 0; i < g->children(); ++i) {
+			n += count_widgets(g->child(i));
+		}
+	}
+	return n;
+}
+
+static size_t resident_bytes() {
+#if defined(__linux__)
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f) return 0;
+	unsigned long size = 0, resident = 0;
+	int n = fscanf(f, "%lu %lu", &size, &resident);
+	fclose(f);
+	return n == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+	return 0;
+#endif
+}
+
+// widget bytes are the objects themselves; offscreens count 4 bytes per device pixel
+void Main_Window::print_memory_report(FILE *f) {
+	size_t notes = _note_model->num_notes();
+	size_t note_bytes = _note_model->note_bytes();
+	size_t index_bytes = _note_model->index_bytes();
+	size_t widget_bytes = sizeof(*this) + sizeof(Fl_Menu_Bar) + sizeof(Fl_Group) + sizeof(Fl_Box) + sizeof(Fl_Slider) +
+		3 * sizeof(Status_Value) + sizeof(Piano_Overview) + _piano_roll->widget_bytes();
+	size_t cache_bytes = text_cache.bytes() + _piano_roll->cache_bytes() + vector_bytes(_damage.rects());
+	size_t back_buffer_bytes = (size_t)(_back_buffer_w * _back_buffer_scale) * (size_t)(_back_buffer_h * _back_buffer_scale) * 4;
+	size_t offscreen_bytes = back_buffer_bytes + _piano_roll->offscreen_bytes() + _overview->image_bytes();
+	size_t rss = resident_bytes();
+
+	fprintf(
+		f, "memory: notes=%zu note_data=%zu indices=%zu bytes_per_note=%.1f\n",
+		notes, note_bytes, index_bytes, notes ? (double)(note_bytes + index_bytes) / notes : 0.0
+	);
+	fprintf(
+		f, "memory: widgets=%d widget_bytes=%zu caches=%zu offscreens=%zu\n",
+		count_widgets(this), widget_bytes, cache_bytes, offscreen_bytes
+	);
+	if (rss) {
+		fprintf(f, "memory: rss=%zu\n", rss);
+	}
+	else {
+		fprintf(f, "memory: rss unavailable\n");
+	}
+}
+
+// reports once the first frames have created the offscreens
+void Main_Window::schedule_memory_report() {
+	Fl::add_timeout(1.0, (Fl_Timeout_Handler)memory_report_timeout_cb, this);
+}
+
+void Main_Window::memory_report_timeout_cb(Main_Window *mw) {
+	memory_report_cb(nullptr, mw);
+}
+
+void Main_Window::stress_stop_cb(Main_Window *mw) {
+	mw->post_command(Transport_Command::STOP);
+	Fl::add_timeout(1.0, (Fl_Timeout_Handler)stress_check_cb, mw);
+}
+
+void Main_Window::stress_check_cb(Main_Window *mw) {
+	// the awake queue never held more than one wakeup, each ran exactly once, and the last applied the stop
+	uint64_t posted = mw->_awakes_posted.load();
+	int max_outstanding = mw->_max_awakes_outstanding.load();
+	bool ok = max_outstanding <= 1 && mw->_syncs_run == posted && mw->_awakes_outstanding.load() == 0 && mw->stopped() && mw->_tick == -1;
+	printf(
+		"stress-wakeups: posted=%llu run=%llu max_outstanding=%d stopped=%s -> %s\n",
+		(unsigned long long)posted, (unsigned long long)mw->_syncs_run, max_outstanding, mw->stopped() ? "yes" : "no", ok ? "ok" : "FAILED"
+	);
+	mw->_exit_code = ok ? 0 : 1;
+	mw->_stress_wakeups = false;
+	mw->hide();
+}
+
+void Main_Window::update_active_controls() {
+	bool stopped = this->stopped();
+	_play_pause_mi->activate();
+	if (!stopped) {
+		_stop_mi->activate();
+	}
+	else {
+		_stop_mi->deactivate();
+	}
+
+	_menu_bar->update();
+}
+
+void Main_Window::toggle_playback() {
+	if (stopped()) {
+		if (_it_module.ready()) {
+			post_command(Transport_Command::PLAY);
+			_transport.playing = true;
+			_transport.paused = false;
+			_piano_roll->start_following();
+			update_active_controls();
+		}
+		else {
+			return;
+		}
+	}
+	else if (paused()) {
+		if (_it_module.ready()) {
+			post_command(Transport_Command::PLAY);
+			_transport.playing = true;
+			_transport.paused = false;
+			_piano_roll->unpause_following();
+			update_active_controls();
+		}
+		else {
+			return;
+		}
+	}
+	else { // if (playing())
+		post_command(Transport_Command::PAUSE);
+		_transport.playing = false;
+		_transport.paused = true;
+		_piano_roll->pause_following();
+		update_active_controls();
+	}
+}
+
+void Main_Window::stop_playback() {
+	if (!stopped()) {
+		post_command(Transport_Command::STOP);
+		_transport.playing = false;
+		_transport.paused = false;
+		set_tick(-1);
+		_piano_roll->stop_following();
+		_note_model->reset_highlight();
+		update_active_controls();
+	}
+}
+
+// the worker is started on first use, so it picks up the scheduling options set after construction
+void Main_Window::start_audio_thread() {
+	if (!_audio_thread.joinable()) {
+		_audio_thread = std::thread(&playback_thread, this);
+	}
+}
+
+void Main_Window::stop_audio_thread() {
+	if (_audio_thread.joinable()) {
+		_audio_mutex.lock();
+		_audio_commands.push_back({ Transport_Command::QUIT, 0 });
+		_audio_mutex.unlock();
+		_audio_cv.notify_one();
+		_audio_thread.join();
+	}
+}
+
+void Main_Window::post_command(Transport_Command command, int32_t value) {
+	start_audio_thread();
+	_audio_mutex.lock();
+	_audio_commands.push_back({ command, value });
+	_audio_mutex.unlock();
+	_commands_sent += 1;
+	_audio_cv.notify_one();
+}
+
+void Main_Window::update_layout() {
+	_piano_roll->position(0, MENU_BAR_HEIGHT);
+	_piano_roll->set_size(w(), h() - MENU_BAR_HEIGHT - OVERVIEW_HEIGHT - STATUS_BAR_HEIGHT);
+	_overview->resize(0, h() - STATUS_BAR_HEIGHT - OVERVIEW_HEIGHT, w(), OVERVIEW_HEIGHT);
+	size_range(
+		WHITE_KEY_WIDTH * 3 + Fl::scrollbar_size(),
+		MENU_BAR_HEIGHT + _piano_roll->octave_height() + Fl::scrollbar_size() + OVERVIEW_HEIGHT + STATUS_BAR_HEIGHT,
+		0,
+		MENU_BAR_HEIGHT + _piano_roll->octave_height() * NUM_OCTAVES + Fl::scrollbar_size() + OVERVIEW_HEIGHT + STATUS_BAR_HEIGHT
+	);
+}
+
+void Main_Window::seek(int32_t tick) {
+	if (stopped()) {
+		_piano_roll->scroll_to_tick(tick);
+		return;
+	}
+
+	set_tick(std::min(std::max(tick, 0), SONG_LENGTH - 1));
+	post_command(Transport_Command::SEEK, _tick);
+
+	_note_model->highlight_tick(_tick);
+}
+
+void Main_Window::set_tick(int32_t tick) {
+	_tick = tick;
+	_tick_label->value(tick);
+}
+
+void Main_Window::speed_slider_cb(Fl_Widget *w) {
+	Main_Window *mw = (Main_Window *)w->user_data();
+	int speed = (int)mw->_speed_slider->value();
+	if (speed != mw->_transport.speed) {
+		mw->_transport.speed = speed;
+		mw->post_command(Transport_Command::SPEED, speed);
+	}
+}
+
+void Main_Window::play_pause_cb(Fl_Widget *, Main_Window *mw) {
+	mw->_latency.input(mw->_commands_sent + 1);
+	mw->toggle_playback();
+}
+
+void Main_Window::stop_cb(Fl_Widget *, Main_Window *mw) {
+	if (!mw->stopped()) {
+		mw->_latency.input(mw->_commands_sent + 1);
+	}
+	mw->stop_playback();
+}
+
+void Main_Window::seek_back_cb(Fl_Widget *, Main_Window *mw) {
+	int32_t tick = mw->stopped() ? mw->_piano_roll->first_visible_tick() : mw->_tick;
+	mw->seek(std::max(tick - SEEK_STEP_TICKS, 0));
+}
+
+void Main_Window::seek_forward_cb(Fl_Widget *, Main_Window *mw) {
+	int32_t tick = mw->stopped() ? mw->_piano_roll->first_visible_tick() : mw->_tick;
+	mw->seek(std::min(tick + SEEK_STEP_TICKS, SONG_LENGTH - 1));
+}
+
+void Main_Window::seek_start_cb(Fl_Widget *, Main_Window *mw) {
+	mw->seek(0);
+}
+
+void Main_Window::continuous_cb(Fl_Widget *, Main_Window *mw) {
+	mw->_piano_roll->set_continuous_scroll(mw->continuous_scroll());
+	mw->redraw();
+}
+
+void Main_Window::full_screen_cb(Fl_Widget *, Main_Window *mw) {
+	if (mw->full_screen()) {
+		mw->fullscreen();
+	}
+	else {
+		mw->fullscreen_off();
+	}
+}
+
+void Main_Window::benchmark_cb(Main_Window *mw) {
+	mw->stop_playback();
+	printf(
+		"benchmark: %d s, %dx%d, scale %.2f%s\n",
+		mw->_benchmark_seconds, mw->w(), mw->h(), Fl::screen_scale(mw->screen_num()), mw->full_screen() ? ", full screen" : ""
+	);
+	mw->_frame_times.print(stdout, "frame time");
+	mw->_frame_intervals.print(stdout, "frame interval");
+	mw->_damage.print_counters(stdout);
+	mw->_latency.print(stdout);
+	printf("quality: level=%d changes=%d\n", (int)mw->_quality.quality(), mw->_quality.changes());
+	if (allocation_tracker.enabled()) {
+		allocation_tracker.print(stdout);
+	}
+	mw->_benchmark_seconds = 0;
+	mw->hide();
+}
+
+// timed by the caller: as a frame task in flush(), or as part of event dispatch
+void Main_Window::layout_cb(Main_Window *mw) {
+	mw->_piano_roll->position(0, MENU_BAR_HEIGHT);
+	mw->_piano_roll->set_size(mw->w(), mw->h() - MENU_BAR_HEIGHT - OVERVIEW_HEIGHT - STATUS_BAR_HEIGHT);
+	mw->_overview->resize(0, mw->h() - STATUS_BAR_HEIGHT - OVERVIEW_HEIGHT, mw->w(), OVERVIEW_HEIGHT);
+	mw->redraw();
+}
+
+void Main_Window::zoom_in_cb(Fl_Widget *, Main_Window *mw) {
+	mw->_piano_roll->set_tick_width(std::min(mw->_piano_roll->tick_width() + 1, MAX_TICK_WIDTH));
+}
+
+void Main_Window::zoom_out_cb(Fl_Widget *, Main_Window *mw) {
+	mw->_piano_roll->set_tick_width(std::max(mw->_piano_roll->tick_width() - 1, 1));
+}
+
+void Main_Window::adaptive_quality_cb(Fl_Widget *, Main_Window *mw) {
+	mw->_quality.reset();
+	mw->_piano_roll->set_render_quality(mw->_quality.quality());
+}
+
+void Main_Window::memory_report_cb(Fl_Widget *, Main_Window *mw) {
+	mw->print_memory_report(stdout);
+	fflush(stdout);
+}
+
+void Main_Window::piano_roll_cb(Piano_Roll *p, Main_Window *mw) {
+	int32_t seek_tick = p->take_seek_tick();
+	if (seek_tick != -1) {
+		mw->seek(seek_tick);
+	}
+	mw->_overview->viewport_changed();
+}
+
+void Main_Window::overview_cb(Piano_Overview *o, Main_Window *mw) {
+	mw->seek(o->seek_tick());
+}
+
+void Main_Window::playback_thread(Main_Window *mw) {
+	apply_thread_scheduling(mw->_playback_scheduling, "playback");
+	Allocation_Tracker::current_thread(Allocation_Tracker::PLAYBACK_THREAD);
+	IT_Module &mod = mw->_it_module;
+	Clock::time_point next_step = Clock::now();
+	auto has_commands = [mw]() { return !mw->_audio_commands.empty(); };
+
+	std::unique_lock<std::mutex> lock(mw->_audio_mutex);
+	for (;;) {
+		if (mod.playing()) {
+			mw->_audio_cv.wait_until(lock, next_step, has_commands);
+		}
+		else {
+			mw->_audio_cv.wait(lock, has_commands);
+		}
+
+		bool changed = false;
+		while (!mw->_audio_commands.empty()) {
+			Transport_Message m = mw->_audio_commands.front();
+			mw->_audio_commands.pop_front();
+			mw->_commands_applied += 1;
+			mw->_command_applied_time = Clock::now();
+			changed = true;
+			switch (m.command) {
+			case Transport_Command::PLAY:
+				if (!mod.playing() && mod.start()) {
+					next_step = Clock::now() + mw->_playback_step;
+				}
+				break;
+			case Transport_Command::PAUSE:
+				mod.pause();
+				break;
+			case Transport_Command::STOP:
+				mod.stop();
+				break;
+			case Transport_Command::SEEK:
+				mod.seek(m.value);
+				break;
+			case Transport_Command::SPEED:
+				mod.speed(m.value);
+				break;
+			case Transport_Command::QUIT:
+				return;
+			}
+		}
+
+		Clock::time_point now = Clock::now();
+		if (mod.playing() && now >= next_step) {
+			mod.play();
+			next_step += mw->_playback_step;
+			// after a stall, resume the normal pace instead of catching up
+			if (next_step < now) {
+				next_step = now + mw->_playback_step;
+			}
+		}
+
+		int32_t t = mod.stopped() ? -1 : mod.current_tick();
+		if (changed || t != mw->_worker_tick) {
+			mw->_worker_tick = t;
+			mw->request_sync();
+		}
+	}
+}
+
+void Main_Window::request_sync() {
+	if (_sync_pending.exchange(true)) return;
+	int outstanding = ++_awakes_outstanding;
+	if (outstanding > _max_awakes_outstanding.load()) {
+		_max_awakes_outstanding.store(outstanding);
+	}
+	if (Fl::awake((Fl_Awake_Handler)sync_cb, this) != 0) {
+		// the awake queue is full; let the next published tick try again
+		--_awakes_outstanding;
+		_sync_pending.store(false);
+		return;
+	}
+	_awakes_posted += 1;
+}
+
+void Main_Window::trailing_sync_cb(Main_Window *mw) {
+	mw->request_sync();
+}
+
+void Main_Window::sync_cb(Main_Window *mw) {
+	Clock::time_point start = Clock::now();
+	mw->_accounting.awake();
+	mw->_syncs_run += 1;
+	--mw->_awakes_outstanding;
+	// clear the flag before reading, so anything published after the read posts a new wakeup
+	mw->_sync_pending.store(false);
+	if (mw->_stress_wakeups) {
+		std::this_thread::sleep_for(STRESS_SYNC_DELAY);
+	}
+	mw->_audio_mutex.lock();
+	int32_t tick = mw->_worker_tick;
+	// a tick published before the worker saw every posted command is stale
+	bool current = mw->_commands_applied == mw->_commands_sent;
+	Clock::time_point applied = mw->_command_applied_time;
+	mw->_audio_mutex.unlock();
+
+	if (!current) {
+		mw->_accounting.add(Loop_Accounting::SYNC, start);
+		return;
+	}
+	if (mw->_latency.command() && !mw->_latency.synced() && mw->_commands_sent >= mw->_latency.command()) {
+		mw->_latency.sync(applied);
+		// make sure a frame is presented even if nothing else changed
+		mw->_damage.add(mw->_status_bar);
+	}
+	if ((mw->playing() || mw->paused()) && tick > 0) {
+		// at the lowest quality, follow the cursor at half the frame rate; transport changes apply at once
+		double since = elapsed_ms(mw->_last_highlight, start);
+		if (
+			mw->playing() && mw->_commands_sent == mw->_highlight_commands &&
+			mw->_piano_roll->render_quality() >= Render_Quality::REDUCED_RATE && since < 2.0 * FRAME_BUDGET_MS
+		) {
+			// deliver the skipped tick later in case no newer one arrives
+			Fl::remove_timeout((Fl_Timeout_Handler)trailing_sync_cb, mw);
+			Fl::add_timeout((2.0 * FRAME_BUDGET_MS - since) / 1000.0, (Fl_Timeout_Handler)trailing_sync_cb, mw);
+			mw->_accounting.add(Loop_Accounting::SYNC, start);
+			return;
+		}
+		mw->_last_highlight = start;
+		mw->_highlight_commands = mw->_commands_sent;
+		mw->set_tick(tick);
+		mw->_note_model->highlight_tick(tick);
+	}
+	else if (!mw->stopped() && tick == -1) {
+		mw->_transport.playing = false;
+		mw->_transport.paused = false;
+		mw->set_tick(-1);
+		mw->_piano_roll->stop_following();
+		mw->_note_model->reset_highlight();
+		mw->update_active_controls();
+	}
+	mw->_accounting.add(Loop_Accounting::SYNC, start);
+}
+
+struct Options {
+	int benchmark_seconds = 0;
+	bool full_screen = false;
+	float scale = 0.0f;
+	Damage_Costs damage_costs;
+	Thread_Scheduling playback_scheduling;
+	Thread_Scheduling ui_scheduling;
+	bool report_latency = false;
+	bool accounting = false;
+	int stress_wakeups_seconds = 0;
+	bool adaptive_quality = false;
+	bool cpu_render = false;
+	bool track_allocations = false;
+	int check_allocations_seconds = 0;
+	bool memory_report = false;
+};
+
+static Main_Window *window = nullptr;
+static Options options;
+
+static int accounting_dispatch(int event, Fl_Window *w) {
+	Clock::time_point start = Clock::now();
+	int handled = Fl::handle_(event, w);
+	window->accounting().add(Loop_Accounting::DISPATCH, start);
+	return handled;
+}
+
+static int handle_arg(int argc, char **argv, int &i) {
+	if (!strcmp(argv[i], "--fullscreen")) {
+		options.full_screen = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--memory-report")) {
+		options.memory_report = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--track-allocations")) {
+		options.track_allocations = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--cpu-render")) {
+		options.cpu_render = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--adaptive-quality")) {
+		options.adaptive_quality = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--accounting")) {
+		options.accounting = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--latency")) {
+		options.report_latency = true;
+		i += 1;
+		return 1;
+	}
+	if (!strcmp(argv[i], "--realtime")) {
+		options.playback_scheduling.realtime = true;
+		i += 1;
+		return 1;
+	}
+	if (i + 1 >= argc) {
+		return 0;
+	}
+	if (!strcmp(argv[i], "--check-allocations")) {
+		options.check_allocations_seconds = atoi(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--stress-wakeups")) {
+		options.stress_wakeups_seconds = atoi(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--playback-cpu")) {
+		options.playback_scheduling.cpu = atoi(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--ui-cpu")) {
+		options.ui_scheduling.cpu = atoi(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--benchmark")) {
+		options.benchmark_seconds = atoi(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--scale")) {
+		options.scale = (float)atof(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--damage-rect-cost")) {
+		options.damage_costs.rect_overhead = atoll(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	if (!strcmp(argv[i], "--damage-coverage")) {
+		options.damage_costs.full_repaint_coverage = atof(argv[i + 1]);
+		i += 2;
+		return 2;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	Allocation_Tracker::current_thread(Allocation_Tracker::UI_THREAD);
+	int i = 0;
+	if (Fl::args(argc, argv, i, handle_arg) < argc) {
+		Fl::fatal(
+			"error: unknown option: %s\n"
+			"usage: %s [options]\n"
+			" --benchmark seconds : play for the given time, print frame times and exit\n"
+			" --fullscreen        : start in full screen mode\n"
+			" --adaptive-quality  : lower render quality while frames are over budget\n"
+			" --cpu-render        : render the piano roll into a CPU framebuffer\n"
+			" --scale factor      : override the screen scale factor\n"
+			" --damage-rect-cost pixels : cost of one extra region pass when merging damage\n"
+			" --damage-coverage fraction : repaint everything when damage covers this much of the window\n"
+			" --playback-cpu n    : pin the playback thread to cpu n\n"
+			" --ui-cpu n          : pin the UI thread to cpu n\n"
+			" --realtime          : run the playback thread with real-time priority if permitted\n"
+			" --latency           : print play/pause/stop latency statistics on exit\n"
+			" --accounting        : print where the UI thread spends each second\n"
+			" --stress-wakeups seconds : check wakeup coalescing under load and exit nonzero on failure\n"
+			" --track-allocations : count heap allocations per frame and per thread\n"
+			" --memory-report     : print memory used per subsystem after startup\n"
+			" --check-allocations seconds : fail if steady-state playback allocates on the UI or playback thread\n"
+			"%s",
+			argv[i], argv[0], Fl::help
+		);
+	}
+	if (options.scale > 0.0f) {
+		for (int n = 0; n < Fl::screen_count(); ++n) {
+			Fl::screen_scale(n, options.scale);
+		}
+	}
+
+	window = new Main_Window(48, 48, 800, 600);
+	window->damage_costs(options.damage_costs);
+	window->playback_scheduling(options.playback_scheduling);
+	window->report_latency(options.report_latency);
+	apply_thread_scheduling(options.ui_scheduling, "UI");
+	if (options.full_screen) {
+		window->full_screen(true);
+	}
+	if (options.adaptive_quality) {
+		window->adaptive_quality(true);
+	}
+	window->cpu_render(options.cpu_render);
+	window->track_allocations(options.track_allocations);
+	Fl::lock();
+	window->show(argc, argv);
+	if (options.accounting) {
+		Fl::event_dispatch(accounting_dispatch);
+		window->start_accounting();
+	}
+	if (options.memory_report) {
+		window->schedule_memory_report();
+	}
+	if (options.benchmark_seconds > 0) {
+		window->start_benchmark(options.benchmark_seconds);
+	}
+	else if (options.stress_wakeups_seconds > 0) {
+		window->start_wakeup_stress(options.stress_wakeups_seconds);
+	}
+	else if (options.check_allocations_seconds > 0) {
+		window->start_allocation_check(options.check_allocations_seconds);
+	}
+	int result = Fl::run();
+	return result ? result : window->exit_code();
+}